@@ -29,10 +29,11 @@
 #define INPUT_PIN 2
 #define OUTPUT_PIN 3
 
-GeminiFrame 
-    gemini(INPUT_PIN, OUTPUT_PIN, 10, 80, 170,
+// We only receive data, so the output FIFO can be reduced to the minimum size
+GeminiFrameT<INPUT_FIFO_SIZE, 8>
+    gemini(INPUT_PIN, OUTPUT_PIN, 10, 10000, 170,
            90); ///< handle the interface to the K197 using the Gemini Protocol
-                // in, out, write pulse, (not used), read delay, write delay
+                // in, out, write pulse, handshake timeout, read delay, write delay
 
 uint8_t inputFrame[4]; ///< buffer for a complete K197 measurement frame (4 bytes) 
 
@@ -28,10 +28,12 @@
 #define INPUT_PIN 2  ///< input pin (MUST support edge interrupts)
 #define OUTPUT_PIN 3 ///< output pin (any I/O pin can be used)
 
-GeminiK197Control
-    gemini(INPUT_PIN, OUTPUT_PIN, 10, 80, 170,
+#define MEASUREMENT_QUEUE 4 ///< measurements buffered while printing
+
+GeminiK197ControlT<INPUT_FIFO_SIZE, OUTPUT_FIFO_SIZE, MEASUREMENT_QUEUE>
+    gemini(INPUT_PIN, OUTPUT_PIN, 10, 10000, 170,
            90); ///< handle the interface to the K197 using the Gemini Protocol
-                // in, out, write pulse, (not used), read delay, write delay
+                // in, out, write pulse, handshake timeout, read delay, write delay
 
 bool logOnce = false;   ///< flag, will log the next measurement when set
 bool logAlways = true; ///< flag, will log all measurements when set
@@ -287,25 +289,36 @@ void setup() {
   // The K197 must be the one initiating the communication,
   // so the following line is essential
   gemini.setInitiatorMode(false); 
+
+  // uncomment the following line to sleep between frames (lower power)
+  // gemini.setIdleSleep(true);
+
+  // uncomment the following line to look for the fastest timing that works
+  // with this K197 (the measurements received until gemini.isCalibrating()
+  // returns false should be discarded)
+  // gemini.startCalibration();
 }
 
 /*!
       @brief Arduino loop function
       @details handle serial port communication and then call update to handle the K197 control protocol. 
-      When a complete frame has been received retrieves the measurement buffer and print the measurement result.
+      When a measurement has been received retrieves it from the measurement queue and print the measurement result.
 */
 void loop() {
   if (Serial.available()) {
     handleSerial();
   }
   gemini.update();
-  if (gemini.frameComplete()) {
-    gemini.resetFrame(); // Must call resetFrame() or getFrame as soon as
-                         // possible after frameComplete returns true...
+#ifdef GEMINI_TRACE_SIZE
+  gemini.getTrace().dump(Serial); // see geminiTraceDecode.cpp in extras/host
+#endif // GEMINI_TRACE_SIZE
+  GeminiK197Control::K197measurement measurement;
+  // with a measurement queue, frameComplete() is handled by update() and
+  // the measurements received can be retrieved with popMeasurement()
+  if (gemini.popMeasurement(&measurement)) {
     if (logOnce || logAlways) {
       logOnce = false;
-      GeminiK197Control::K197measurement *pmeasurement =
-          gemini.getMeasurementBuffer();
+      GeminiK197Control::K197measurement *pmeasurement = &measurement;
 
       // Uncomment one or more of the following statements for alternative ways to
       // print the data or for troubleshooting
@@ -336,4 +349,19 @@ void loop() {
     Serial.println(F(" frame timeouts!"));
     gemini.resetFrameTimeoutCounter();
   }
+  if (gemini.measurementOverrunDetected()) {
+    Serial.print(gemini.getMeasurementOverrunCounter());
+    Serial.println(F(" measurements lost!"));
+    gemini.resetMeasurementOverrunCounter();
+  }
+  if (gemini.handshakeTimeoutDetected()) {
+    Serial.print(gemini.getHandshakeTimeoutCounter());
+    Serial.println(F(" acknowledge timeouts!"));
+    gemini.resetHandshakeTimeoutCounter();
+  }
+  if (gemini.protocolErrorDetected()) {
+    Serial.print(gemini.getProtocolErrorCounter());
+    Serial.println(F(" protocol errors!"));
+    gemini.resetProtocolErrorCounter();
+  }
 }
@@ -43,9 +43,9 @@ uint8_t *cmd[] = {cmd_0, cmd_1, cmd_2, cmd_3, cmd_4, cmd_5}; ///< consolidate al
 const size_t cmd_size = sizeof(cmd_0) / sizeof(cmd_0[0]); ///< size of a pre-defined command
 
 GeminiFrame 
-    gemini(INPUT_PIN, OUTPUT_PIN, 10, 80, 170,
+    gemini(INPUT_PIN, OUTPUT_PIN, 10, 10000, 170,
            90); ///< handle the interface to the K197 using the Gemini Framing Protocol
-                // in, out, write pulse, (not used), read delay, write delay
+                // in, out, write pulse, handshake timeout, read delay, write delay
 
 bool logOnce = false;  ///< flag, will log the next frame when set
 bool logAlways = true; ///< flag, will log all frames when set
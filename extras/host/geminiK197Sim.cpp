@@ -0,0 +1,341 @@
+/**************************************************************************/
+/*!
+  @file     geminiK197Sim.cpp
+
+  Arduino K197Control library sketch
+
+  Copyright (C) 2023 by ALX2009
+
+  License: MIT (see LICENSE)
+
+  This file is part of the Arduino K197control library, please see
+  https://github.com/alx2009/K197Control for more information
+
+  Note: this file implements the class GeminiK197Sim
+*/
+#include <math.h>
+#include <string.h>
+
+#include "geminiK197Sim.h"
+
+#define K197SIM_DBM_REFERENCE 0.7746 ///< 0 dBm (1 mW in 600 Ohm), in Volt
+#define K197SIM_DB_RANGE 7 ///< range used in dB mode (0.001 dB resolution)
+
+/*!
+     @brief  constructor for the class, with the default parameters
+     @param inputPin input pin
+     @param outputPin output pin
+*/
+GeminiK197Sim::GeminiK197Sim(uint8_t inputPin, uint8_t outputPin)
+    : GeminiK197Sim(inputPin, outputPin, Config()) {}
+
+/*!
+     @brief  constructor for the class
+     @details the emulator starts measuring continuously when attached to a
+   simulation (see GeminiSimPeer::attach())
+     @param inputPin input pin
+     @param outputPin output pin
+     @param config emulator parameters. readDelayMicros must be greater than
+   writeDelayMicros
+*/
+GeminiK197Sim::GeminiK197Sim(uint8_t inputPin, uint8_t outputPin,
+                             const Config &config)
+    : GeminiSimPeer(inputPin, outputPin), config(config) {
+  lastMeasurement.uvalue = 0;
+  lastControl.clear();
+}
+
+/*!
+     @brief  set the function, as if using the front panel
+     @details dB mode is turned off if the new function is not Volt
+     @param newUnit the function (Volt, Ohm or Amp)
+     @param newAC true for AC, false for DC
+*/
+void GeminiK197Sim::setFunction(K197unit newUnit, bool newAC) {
+  unit = newUnit == K197unit::dB ? K197unit::Volt : newUnit;
+  ac = newAC;
+  if (unit != K197unit::Volt) {
+    dBmode = false;
+  }
+}
+
+/*!
+     @brief  called when the level of the input pin changes
+     @details a rising edge while waiting for the acknowledge is the
+   acknowledge. Any other edge is ignored (the K197 is always the initiator)
+     @param level the new level
+*/
+void GeminiK197Sim::edge(bool level) {
+  if (!level || state != State::WAIT_ACK) {
+    return;
+  }
+  lastEventTime = now();
+  state = State::READ;
+  if (frameBits[frameIndex - 1]) { // a 0 bit is already LOW
+    drive(false, config.writeDelayMicros);
+  }
+}
+
+/*!
+     @brief  called at every simulation step
+*/
+void GeminiK197Sim::update() {
+  unsigned long currentTime = now();
+  switch (state) {
+  case State::IDLE:
+    if ((long)(currentTime - nextFrameTime) >= 0) {
+      startFrame();
+    }
+    break;
+  case State::WAIT_ACK:
+    if (currentTime - lastEventTime >= config.handshakeTimeoutMicros) {
+      handshakeTimeoutCounter++;
+      endFrame(true);
+    }
+    break;
+  case State::READ:
+    if (currentTime - lastEventTime >= config.readDelayMicros) {
+      receiveBit(input());
+    }
+    break;
+  }
+}
+
+/*!
+     @brief  start a new frame: a measurement, or an empty frame while waiting
+   for a trigger
+*/
+void GeminiK197Sim::startFrame() {
+  frameLength = 0;
+  frameIndex = 0;
+  rxBytes = 0;
+  rxBits = 0;
+  frameIsMeasurement = !waitingTrigger;
+  if (frameIsMeasurement) {
+    measure();
+    appendBits(0, K197SIM_SYNC_ZEROS);
+    uint8_t *pdata = (uint8_t *)&lastMeasurement;
+    for (uint8_t i = 0; i < K197SIM_MEASUREMENT_BYTES; i++) {
+      appendBits(0x100 | pdata[i], 9);
+    }
+    measurementCounter++;
+    if (triggerMode & K197triggerMode::T_Once_bm) { // one reading per trigger
+      waitingTrigger = true;
+    }
+  } else {
+    appendBits(0, config.pollZeros);
+    pollCounter++;
+  }
+  nextFrameTime = now() + (waitingTrigger ? config.pollMicros
+                                          : config.measurementMicros);
+  sendBit();
+}
+
+/*!
+     @brief  send the next bit of the frame
+*/
+void GeminiK197Sim::sendBit() {
+  pulse(config.writePulseMicros, frameBits[frameIndex++]);
+  lastEventTime = now();
+  state = State::WAIT_ACK;
+}
+
+/*!
+     @brief  handle a bit received from the peer
+     @details the frame ends after the last bit has been sent, unless the peer
+   is sending a sub-frame: it must be acknowledged, so a 0 bit is added
+     @param bit the bit received
+*/
+void GeminiK197Sim::receiveBit(bool bit) {
+  bool subFrame = false;
+  if (rxBytes < K197SIM_CONTROL_BYTES) {
+    if (rxBits > 0 || bit) { // start bit or data bit
+      subFrame = true;
+      rxShift = rxBits == 0 ? 0 : (uint16_t)((rxShift << 1) | bit);
+      if (++rxBits == 9) {
+        rxData[rxBytes++] = (uint8_t)rxShift;
+        rxBits = 0;
+      }
+    }
+  }
+  if (frameIndex < frameLength) {
+    sendBit();
+  } else if (subFrame && frameLength < K197SIM_MAX_FRAME_BITS) {
+    appendBits(0, 1);
+    sendBit();
+  } else {
+    endFrame(false);
+  }
+}
+
+/*!
+     @brief  end the current frame, applying the control frame received
+     @param aborted true if the frame was aborted (acknowledge timeout)
+*/
+void GeminiK197Sim::endFrame(bool aborted) {
+  state = State::IDLE;
+  if (aborted) {
+    drive(false);
+  } else if (rxBytes == K197SIM_CONTROL_BYTES) {
+    applyControl();
+  }
+}
+
+/*!
+     @brief  add bits to the current frame
+     @param bits the bits to add, MSB first
+     @param nbits the number of bits to add (up to 16)
+*/
+void GeminiK197Sim::appendBits(uint16_t bits, uint8_t nbits) {
+  while (nbits > 0 && frameLength < K197SIM_MAX_FRAME_BITS) {
+    nbits--;
+    frameBits[frameLength++] = (bits >> nbits) & 0x01;
+  }
+}
+
+/*!
+     @brief  apply the control frame received
+*/
+void GeminiK197Sim::applyControl() {
+  K197control &control = lastControl;
+  memcpy(&control, rxData, K197SIM_CONTROL_BYTES);
+  controlCounter++;
+
+  if (control.byte0.set_db && unit == K197unit::Volt &&
+      control.byte0.dB != dBmode) {
+    dBmode = control.byte0.dB;
+    relative = false; // the reference is in the old unit
+  }
+  if (control.byte0.set_rel) {
+    if (control.byte0.relative && !relative) {
+      reference = reading(); // relative is false here
+    }
+    relative = control.byte0.relative;
+  }
+  if (control.byte0.set_range && control.byte0.range <= K197range::R5) {
+    range = control.byte0.range;
+  }
+  if (control.byte1.set_ctrl_mode) {
+    remote = control.byte1.ctrl_mode;
+  }
+  if (control.byte2.set_sent_readings) {
+    sendStored = control.byte2.sent_readings;
+    storedSent = 0;
+  }
+
+  uint8_t newMode = control.byte1.set_trigger ? control.byte1.trigger : 0;
+  bool isTrigger = false;
+  switch (newMode) {
+  case K197triggerMode::T0:
+  case K197triggerMode::T1:
+  case K197triggerMode::T4:
+  case K197triggerMode::T5:
+    triggerMode = (K197triggerMode)newMode;
+    waitingTrigger = true;
+    nextFrameTime = now() + config.pollMicros;
+    break;
+  case K197triggerMode::T_TALK:
+    isTrigger = true;
+    break;
+  default: // in T4 and T5 any control frame is a trigger
+    isTrigger = triggerMode & K197triggerMode::T_X_bm;
+    break;
+  }
+  if (isTrigger && waitingTrigger) {
+    trigger();
+  }
+}
+
+/*!
+     @brief  trigger a measurement
+     @details the measurement is sent after a conversion (measurementMicros)
+*/
+void GeminiK197Sim::trigger() {
+  waitingTrigger = false;
+  nextFrameTime = now() + config.measurementMicros;
+}
+
+/*!
+     @brief  get the displayed reading
+     @return the reading, in the unit of the measurement (dB in dB mode)
+*/
+double GeminiK197Sim::reading() {
+  double value = source != NULL ? source(sourceContext, now()) : inputValue;
+  if (dBmode) {
+    value = fabs(value) > 1e-9 ? 20.0 * log10(fabs(value) / K197SIM_DBM_REFERENCE)
+                               : -199.999;
+  }
+  if (relative) {
+    value -= reference;
+  }
+  return value;
+}
+
+/*!
+     @brief  take a reading, store it and set the measurement to send
+*/
+void GeminiK197Sim::measure() {
+  K197measurement measurement = encode(reading());
+  stored[storedNext] = measurement;
+  storedNext = (storedNext + 1) % K197SIM_STORED_READINGS;
+  if (storedCount < K197SIM_STORED_READINGS) {
+    storedCount++;
+  }
+  if (sendStored) { // data logger: oldest reading first
+    uint8_t oldest = storedCount < K197SIM_STORED_READINGS ? 0 : storedNext;
+    measurement = stored[(oldest + storedSent) % K197SIM_STORED_READINGS];
+    storedSent = (storedSent + 1) % storedCount;
+  }
+  lastMeasurement = measurement;
+}
+
+/*!
+     @brief  encode a reading as a measurement frame
+     @details in auto range, the lowest range where the reading is below
+   K197SIM_FULL_SCALE counts is used. If the reading does not fit the range,
+   the overrange flag is set
+     @param value the reading
+     @return the measurement frame
+*/
+GeminiK197Types::K197measurement GeminiK197Sim::encode(double value) const {
+  K197measurement measurement;
+  measurement.uvalue = 0;
+  measurement.byte0.unit = dBmode ? K197unit::dB : unit;
+  measurement.byte0.ac_dc = ac;
+  measurement.byte0.relative = relative;
+  measurement.byte0.undefined = true;
+  measurement.byte1.undefined = true;
+
+  uint8_t minRange = 1;
+  uint8_t maxRange = unit == K197unit::Volt  ? 5
+                     : unit == K197unit::Ohm ? 7
+                                             : 6;
+  if (dBmode) {
+    minRange = maxRange = K197SIM_DB_RANGE;
+  } else if (range != K197range::R0_Auto && unit != K197unit::Amp) {
+    minRange = maxRange = range;
+  }
+  unsigned long counts = 0;
+  for (uint8_t r = minRange; r <= maxRange; r++) {
+    measurement.byte0.range = r;
+    double scale = pow(10.0, measurement.getValueExponent() - 5);
+    double displayed = fabs(value) / scale + 0.5;
+    counts = displayed < (double)K197SIM_FULL_SCALE
+                 ? (unsigned long)displayed
+                 : K197SIM_FULL_SCALE;
+    if (counts < K197SIM_FULL_SCALE) {
+      break;
+    }
+  }
+  if (counts >= K197SIM_FULL_SCALE) {
+    measurement.byte1.ovrange = true;
+    counts = 0;
+  }
+  // inverse of getAbsValue(), rounded up so that the conversion is exact
+  unsigned long count = (counts * 16384UL + 3124UL) / 3125UL;
+  measurement.byte1.msb = (count >> 16) & 0x1f;
+  measurement.lsb.hi = (count >> 8) & 0xff;
+  measurement.lsb.lo = count & 0xff;
+  measurement.byte1.negative = (value < 0) && (counts != 0);
+  return measurement;
+}
@@ -0,0 +1,247 @@
+/**************************************************************************/
+/*!
+  @file     geminiK197Sim.h
+
+  Arduino K197Control library
+
+  Copyright (C) 2023 by ALX2009
+
+  License: MIT (see LICENSE)
+
+  This file is part of the Arduino K197Display sketch, please see
+  https://github.com/alx2009/K197Control for more information
+
+  This file defines the GeminiK197Sim class
+  The GeminiK197Sim class emulates a K197 voltmeter connected to a simulated
+  wire (see geminiSim.h), so that GeminiK197Control can be tested end-to-end
+  on the host. Only available in the host build (see geminiHal.h)
+
+*/
+/**************************************************************************/
+#ifndef K197CTRL_GEMINI_K197_SIM_H
+#define K197CTRL_GEMINI_K197_SIM_H
+
+#include "geminiK197Control.h"
+#include "geminiSim.h"
+
+#define K197SIM_SYNC_ZEROS 16 ///< 0 bits sent before a measurement
+#define K197SIM_MEASUREMENT_BYTES 4 ///< sub-frames in a measurement frame
+#define K197SIM_CONTROL_BYTES 5     ///< sub-frames in a control frame
+#define K197SIM_STORED_READINGS 100 ///< readings stored by the data logger
+#define K197SIM_MAX_FRAME_BITS 96   ///< maximum bits in a frame
+#define K197SIM_FULL_SCALE 200000UL ///< display counts (5 1/2 digits)
+
+/*!
+      @brief software model of a K197 voltmeter, the peer of GeminiK197Control
+
+      @details the emulator implements the instrument side of the gemini
+   protocol directly on the simulated wire (it does not use GeminiProtocol),
+   following K197control_protocol_specification.md:
+
+      - the K197 is always the initiator. A measurement frame is a sync
+   sequence of K197SIM_SYNC_ZEROS 0 bits followed by 4 sub-frames, sent every
+   measurementMicros (about 3 times a second) when measuring continuously.
+      - while waiting for a trigger, an empty frame (pollZeros 0 bits, no
+   sub-frames) is sent every pollMicros, so that the IEEE card can send a
+   command.
+      - the bits received in a frame are decoded as a 5 bytes control frame,
+   applied at the end of the frame. If the control frame is longer than the
+   frame sent, 0 bits are added until it has been received.
+
+      The control fields are honored as follows:
+      - range (Volt and Ohm only), relative (the reference is the reading at
+   the time relative mode is set), dB (Volt only, dBm referred to 600 Ohm).
+      - trigger: setting T0/T1/T4/T5 stops the measurements. In T0/T1 a T_TALK
+   command triggers, in T4/T5 any other control frame triggers. T0 and T4
+   measure continuously once triggered, T1 and T5 take one reading per
+   trigger.
+      - remote/local only changes the RMT indicator (isRemote()).
+      - stored readings: the last K197SIM_STORED_READINGS readings are stored,
+   and sent one per frame (oldest first) instead of the displayed reading.
+
+      The input signal is set with setInput() or setSource(), the function
+   (Volt/Ohm/Amp, AC/DC) with setFunction(), as if using the front panel.
+*/
+class GeminiK197Sim : public GeminiSimPeer, public GeminiK197Types {
+public:
+  /*!
+      @brief returns the input signal (V, Ohm or A) at a given virtual time
+  */
+  typedef double (*Source)(void *context, unsigned long time);
+
+  /*!
+      @brief emulator parameters (all times in microseconds)
+  */
+  struct Config {
+    unsigned long writePulseMicros = 10; ///< duration of a 0 bit pulse
+    unsigned long readDelayMicros = 170; ///< acknowledge to bit read
+    unsigned long writeDelayMicros = 90; ///< acknowledge to output LOW
+    unsigned long handshakeTimeoutMicros = 10000; ///< acknowledge timeout
+    unsigned long measurementMicros = 333333; ///< time between measurements
+    unsigned long pollMicros = 100000; ///< time between empty frames
+    uint8_t pollZeros = K197SIM_SYNC_ZEROS; ///< 0 bits in an empty frame
+  };
+
+  GeminiK197Sim(uint8_t inputPin, uint8_t outputPin);
+  GeminiK197Sim(uint8_t inputPin, uint8_t outputPin, const Config &config);
+
+  /*!
+      @brief  set the input signal (front panel function unchanged)
+      @param value the input signal, in V, Ohm or A depending on the function
+  */
+  void setInput(double value) {
+    inputValue = value;
+    source = NULL;
+  };
+  /*!
+      @brief  set a function returning the input signal
+      @param newSource the function (NULL = use the value set with setInput())
+      @param context passed to newSource
+  */
+  void setSource(Source newSource, void *context = NULL) {
+    source = newSource;
+    sourceContext = context;
+  };
+  void setFunction(K197unit newUnit, bool newAC = false);
+
+  /*!
+      @brief  get the last measurement sent
+      @return the last measurement frame sent
+  */
+  const K197measurement &getLastMeasurement() const { return lastMeasurement; };
+  /*!
+      @brief  get the last control frame received
+      @return the last control frame received
+  */
+  const K197control &getLastControl() const { return lastControl; };
+
+  /*!
+      @brief  get the range
+      @return the range set with a control frame (R0 = auto range)
+  */
+  K197range getRange() const { return range; };
+  /*!
+      @brief  check relative mode
+      @return true if relative mode is on
+  */
+  bool isRelative() const { return relative; };
+  /*!
+      @brief  check dB mode
+      @return true if dB mode is on
+  */
+  bool isDbMode() const { return dBmode; };
+  /*!
+      @brief  check the RMT indicator
+      @return true in remote mode
+  */
+  bool isRemote() const { return remote; };
+  /*!
+      @brief  check the source of the readings
+      @return true if the stored readings are sent
+  */
+  bool isSendingStored() const { return sendStored; };
+  /*!
+      @brief  get the trigger mode
+      @return the trigger mode, invalid_000 before a trigger mode is set
+  */
+  K197triggerMode getTriggerMode() const { return triggerMode; };
+  /*!
+      @brief  check if the voltmeter is waiting for a trigger
+      @return true if waiting for a trigger
+  */
+  bool isWaitingTrigger() const { return waitingTrigger; };
+
+  /*!
+      @brief  get the number of measurement frames sent
+      @return the number of measurement frames sent
+  */
+  unsigned long getMeasurementCounter() const { return measurementCounter; };
+  /*!
+      @brief  get the number of empty frames sent
+      @return the number of empty frames sent
+  */
+  unsigned long getPollCounter() const { return pollCounter; };
+  /*!
+      @brief  get the number of control frames received
+      @return the number of control frames received
+  */
+  unsigned long getControlCounter() const { return controlCounter; };
+  /*!
+      @brief  get the number of frames aborted (acknowledge timeout)
+      @return the number of acknowledge timeouts
+  */
+  unsigned long getHandshakeTimeoutCounter() const {
+    return handshakeTimeoutCounter;
+  };
+
+protected:
+  void edge(bool level) override;
+  void update() override;
+
+private:
+  /*!
+      @brief state machine for the instrument side of the protocol
+  */
+  enum class State {
+    IDLE,     ///< waiting for the next frame
+    WAIT_ACK, ///< a bit has been sent, waiting for the acknowledge
+    READ,     ///< acknowledge received, waiting to read the peer bit
+  };
+
+  void startFrame();
+  void sendBit();
+  void receiveBit(bool bit);
+  void endFrame(bool aborted);
+  void appendBits(uint16_t bits, uint8_t nbits);
+  void applyControl();
+  void trigger();
+  double reading();
+  void measure();
+  K197measurement encode(double value) const;
+
+  Config config; ///< emulator parameters
+  State state = State::IDLE; ///< protocol state
+  unsigned long nextFrameTime = 0; ///< when the next frame is sent
+  unsigned long lastEventTime = 0; ///< last bit sent or acknowledge received
+  bool frameIsMeasurement = false; ///< the current frame is a measurement
+
+  bool frameBits[K197SIM_MAX_FRAME_BITS]; ///< bits of the current frame
+  uint8_t frameLength = 0; ///< number of bits in frameBits
+  uint8_t frameIndex = 0;  ///< next bit to send
+
+  uint8_t rxData[K197SIM_CONTROL_BYTES]; ///< control frame being received
+  uint8_t rxBytes = 0;        ///< complete sub-frames received
+  uint8_t rxBits = 0;         ///< bits of the current sub-frame (0 = idle)
+  uint16_t rxShift = 0;       ///< current sub-frame
+
+  double inputValue = 1.0;       ///< input signal (setInput())
+  Source source = NULL;        ///< input signal (setSource())
+  void *sourceContext = NULL;  ///< passed to source
+  K197unit unit = K197unit::Volt; ///< front panel function
+  bool ac = false;             ///< front panel AC/DC
+
+  K197range range = K197range::R0_Auto; ///< range (R0 = auto)
+  bool relative = false;       ///< relative mode
+  double reference = 0.0;      ///< relative mode reference
+  bool dBmode = false;         ///< dB mode
+  bool remote = false;         ///< RMT indicator
+  bool sendStored = false;     ///< send the stored readings
+  K197triggerMode triggerMode =
+      K197triggerMode::invalid_000; ///< trigger mode (invalid_000 = free run)
+  bool waitingTrigger = false; ///< measurements stopped until a trigger
+
+  K197measurement stored[K197SIM_STORED_READINGS]; ///< data logger
+  uint8_t storedCount = 0; ///< readings in the data logger
+  uint8_t storedNext = 0;  ///< next reading stored
+  uint8_t storedSent = 0;  ///< next stored reading sent
+
+  K197measurement lastMeasurement; ///< last measurement sent
+  K197control lastControl;         ///< last control frame received
+
+  unsigned long measurementCounter = 0; ///< measurement frames sent
+  unsigned long pollCounter = 0;        ///< empty frames sent
+  unsigned long controlCounter = 0;     ///< control frames received
+  unsigned long handshakeTimeoutCounter = 0; ///< acknowledge timeouts
+};
+
+#endif // K197CTRL_GEMINI_K197_SIM_H
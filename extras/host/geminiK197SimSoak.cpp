@@ -0,0 +1,362 @@
+/**************************************************************************/
+/*!
+  @file     geminiK197SimSoak.cpp
+
+  Arduino K197Control library sketch
+
+  Copyright (C) 2023 by ALX2009
+
+  License: MIT (see LICENSE)
+
+  This file is part of the Arduino K197control library, please see
+  https://github.com/alx2009/K197Control for more information
+
+  Note: this file is a host program testing GeminiK197Control end-to-end
+  against the K197 emulator (GeminiK197Sim) on a simulated wire. It sends
+  the commands supported by the emulator, checks every measurement received
+  and then runs a soak test with a varying input signal (see README.md in
+  this directory)
+
+  Usage: geminiK197SimSoak [seconds [jitter [step [mode [calibrate]]]]]
+  (seconds of virtual time for the soak test, jitter and step in
+  microseconds). When mode is 1, GeminiK197Control::update() is called only
+  when needsService() returns true. When mode is 2, update() is called at
+  every step with the idle sleep mode enabled. When calibrate is 1, the
+  timing is calibrated before the tests (see
+  GeminiK197ControlT::startCalibration())
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "geminiK197Sim.h"
+
+#define K197_INPUT_PIN 2   ///< input pin of the K197 emulator
+#define K197_OUTPUT_PIN 3  ///< output pin of the K197 emulator
+#define CARD_INPUT_PIN 4   ///< input pin of GeminiK197Control
+#define CARD_OUTPUT_PIN 5  ///< output pin of GeminiK197Control
+
+#define SECOND 1000000UL ///< one second of virtual time (microseconds)
+#define CALIBRATION_STEP_MICROS                                                \
+  1 ///< simulation step while calibrating, fine enough to find the limits
+
+typedef GeminiK197Control::K197measurement K197measurement; ///< shorthand
+typedef GeminiK197Control::K197control K197control;         ///< shorthand
+
+static GeminiSim *sim;        ///< the simulation
+static GeminiK197Sim *k197;   ///< the K197 emulator
+static GeminiK197Control *card; ///< the object under test
+static K197measurement received; ///< measurement buffer of card
+static K197control control;      ///< control buffer of card
+
+static unsigned long measurements = 0; ///< measurements received
+static unsigned long mismatches = 0;   ///< measurements received corrupted
+static unsigned long failures = 0;     ///< failed checks
+static unsigned long updates = 0;      ///< calls to card->update()
+static unsigned long skipped = 0; ///< K197 measurements sent while calibrating
+
+/*!
+     @brief  simulation task: call card->update() only when needed
+     @param context not used
+*/
+static void scheduledUpdate(void *context) {
+  (void)context;
+  if (card->needsService()) {
+    card->update();
+    updates++;
+  }
+}
+
+/*!
+     @brief  simulation task: call card->update() at every step
+     @param context not used
+*/
+static void polledUpdate(void *context) {
+  (void)context;
+  card->update();
+  updates++;
+}
+
+/*!
+     @brief  run the simulation, checking every measurement received
+     @param micros the virtual time to run (microseconds)
+     @return the number of measurements received
+*/
+static unsigned long run(unsigned long micros) {
+  unsigned long count = 0;
+  unsigned long start = sim->now();
+  while (sim->now() - start < micros) {
+    sim->step();
+    if (card->frameComplete()) {
+      card->getFrame();
+      if (received.uvalue != k197->getLastMeasurement().uvalue) {
+        mismatches++;
+      }
+      count++;
+    }
+  }
+  measurements += count;
+  return count;
+}
+
+/*!
+     @brief  send the control buffer and wait until it has been applied
+     @return the number of measurements received in the meantime
+*/
+static unsigned long execute() {
+  unsigned long controls = k197->getControlCounter();
+  card->execute();
+  unsigned long count = 0;
+  unsigned long start = sim->now();
+  while (k197->getControlCounter() == controls &&
+         sim->now() - start < 2 * SECOND) {
+    count += run(1000);
+  }
+  return count;
+}
+
+/*!
+     @brief  report a failed check
+     @param ok the result of the check
+     @param what the description of the check
+*/
+static void check(bool ok, const char *what) {
+  if (!ok) {
+    failures++;
+    printf("FAIL: %s\n", what);
+  }
+}
+
+/*!
+     @brief  calibrate the timing of card, then reset its error counters
+     @details the calibration runs with a simulation step of
+   CALIBRATION_STEP_MICROS, so that too short delays actually cause errors.
+   The measurements received while calibrating are not checked
+     @param stepMicros the simulation step restored after the calibration
+*/
+static void calibrate(unsigned long stepMicros) {
+  GeminiTiming timing = card->getTiming();
+  printf("calibration: from write pulse %lu us, read delay %lu us, write "
+         "delay %lu us\n",
+         timing.writePulseMicros, timing.readDelayMicros,
+         timing.writeDelayMicros);
+  unsigned long start = sim->now();
+  sim->setStepMicros(CALIBRATION_STEP_MICROS);
+  card->startCalibration();
+  while (card->isCalibrating() && sim->now() - start < 600 * SECOND) {
+    sim->step();
+    if (card->frameComplete()) {
+      card->getFrame();
+    }
+  }
+  sim->setStepMicros(stepMicros);
+  check(!card->isCalibrating(), "calibration: complete");
+  check(card->getCalibrationFailures() > 0, "calibration: errors detected");
+  timing = card->getTiming();
+  check(timing.readDelayMicros > GeminiK197Sim::Config().writePulseMicros,
+        "calibration: read delay longer than the K197 pulse");
+  printf("calibration: %u steps (%u rejected) in %.1f s, %lu protocol "
+         "errors, %lu handshake timeouts, %lu frame resyncs, %lu frame "
+         "overflows\n",
+         (unsigned)card->getCalibrationSteps(),
+         (unsigned)card->getCalibrationFailures(),
+         (double)(sim->now() - start) / SECOND,
+         card->getProtocolErrorCounter(), card->getHandshakeTimeoutCounter(),
+         card->getFrameResyncCounter(), card->getFrameOverflowCounter());
+  printf("calibration: to write pulse %lu us, read delay %lu us, write delay "
+         "%lu us\n",
+         timing.writePulseMicros, timing.readDelayMicros,
+         timing.writeDelayMicros);
+  card->resetProtocolErrorCounter();
+  card->resetHandshakeTimeoutCounter();
+  card->resetFrameResyncCounter();
+  card->resetFrameTimeoutCounter();
+  card->resetFrameOverflowCounter();
+  card->resetStats();
+  skipped = k197->getMeasurementCounter();
+}
+
+/*!
+     @brief  check the value of the last measurement received
+     @param expected the expected value
+     @param tolerance the maximum difference
+     @return true if the value is within tolerance
+*/
+static bool near(double expected, double tolerance) {
+  return fabs(received.getValueAsDouble() - expected) <= tolerance;
+}
+
+/*!
+     @brief  input signal for the soak test: a slow sine wave across ranges
+     @param context not used
+     @param time the virtual time (microseconds)
+     @return the input voltage
+*/
+static double sineSource(void *context, unsigned long time) {
+  (void)context;
+  return 25.0 * sin(2.0 * M_PI * (double)time / (7.0 * SECOND));
+}
+
+#ifdef GEMINI_HISTOGRAMS
+/*!
+     @brief  print the non empty buckets of a histogram
+     @param name the name of the histogram
+     @param histogram the histogram
+*/
+static void printHistogram(const char *name, const GeminiHistogram &histogram) {
+  printf("%s: %lu samples\n", name, histogram.getTotal());
+  for (uint8_t b = 0; b < GEMINI_HISTOGRAM_BUCKETS; b++) {
+    if (histogram.getCount(b) != 0) {
+      printf("  >= %6lu us: %u\n", GeminiHistogram::lowerBound(b),
+             (unsigned)histogram.getCount(b));
+    }
+  }
+}
+#endif // GEMINI_HISTOGRAMS
+
+/*!
+     @brief  get an optional argument
+     @param argc number of arguments
+     @param argv arguments
+     @param i index of the argument
+     @param value default value
+     @return the value of the argument, or value if not present
+*/
+static unsigned long arg(int argc, char **argv, int i, unsigned long value) {
+  return argc > i ? strtoul(argv[i], NULL, 10) : value;
+}
+
+int main(int argc, char **argv) {
+  unsigned long soakSeconds = arg(argc, argv, 1, 60);
+  GeminiSim::Config config;
+  config.jitterMicros = arg(argc, argv, 2, 0);
+  config.stepMicros = arg(argc, argv, 3, 10);
+  unsigned long mode = arg(argc, argv, 4, 0);
+  bool calibration = arg(argc, argv, 5, 0) != 0;
+  bool scheduled = mode == 1;
+
+  GeminiSim theSim(config);
+  GeminiK197Sim theK197(K197_INPUT_PIN, K197_OUTPUT_PIN);
+  GeminiK197Control theCard(CARD_INPUT_PIN, CARD_OUTPUT_PIN, 10, 10000, 170,
+                            90);
+  sim = &theSim;
+  k197 = &theK197;
+  card = &theCard;
+  if (!card->begin(&received, &control)) {
+    return 1;
+  }
+  card->setInitiatorMode(false);
+  card->setFrameSync(true);
+  card->setIdleSleep(mode == 2);
+  sim->connect(K197_OUTPUT_PIN, CARD_INPUT_PIN);
+  sim->connect(CARD_OUTPUT_PIN, K197_INPUT_PIN);
+  sim->addTask(scheduled ? scheduledUpdate : polledUpdate, NULL);
+  k197->attach(*sim);
+  clock_t cpuStart = clock();
+
+  if (calibration) {
+    calibrate(config.stepMicros);
+  }
+
+  k197->setInput(1.23456);
+  check(run(3 * SECOND) >= 8, "free run: about 3 measurements per second");
+  check(near(1.23456, 1e-5) && received.byte0.range == 2, "auto range");
+
+  control.setRemoteMode();
+  control.setRange(GeminiK197Control::R3);
+  execute();
+  run(SECOND);
+  check(k197->isRemote(), "remote mode");
+  check(received.byte0.range == 3 && near(1.2346, 1e-4), "range R3");
+
+  control.setRange(GeminiK197Control::R1);
+  execute();
+  run(SECOND);
+  check(received.isOvrange(), "overrange in range R1");
+
+  control.setRange(GeminiK197Control::R0);
+  control.setRelative();
+  execute();
+  k197->setInput(1.5);
+  run(SECOND);
+  check(received.isRelative() && near(0.26544, 1e-5), "relative mode");
+
+  control.setRelative(false);
+  control.setDbMode();
+  execute();
+  run(SECOND);
+  check(received.is_dB() && near(20.0 * log10(1.5 / 0.7746), 1e-3),
+        "dB mode");
+
+  control.setDbMode(false);
+  control.setTriggerMode(GeminiK197Control::T1);
+  execute();
+  run(SECOND);
+  unsigned long polls = k197->getPollCounter();
+  check(run(2 * SECOND) == 0 && k197->isWaitingTrigger(), "T1: stopped");
+  check(k197->getPollCounter() > polls, "T1: empty frames while waiting");
+  for (int i = 0; i < 3; i++) {
+    control.setTriggerMode(GeminiK197Control::T_TALK);
+    unsigned long count = execute();
+    count += run(SECOND);
+    check(count == 1, "T1: one measurement per trigger");
+  }
+
+  control.setTriggerMode(GeminiK197Control::T4);
+  execute();
+  check(run(SECOND) == 0, "T4: stopped");
+  execute(); // an empty control frame is a trigger
+  check(run(3 * SECOND) >= 7, "T4: continuous after trigger");
+
+  k197->setInput(0.5);
+  control.setSendStoredReadings();
+  execute();
+  run(SECOND);
+  check(k197->isSendingStored() && !near(0.5, 0.1), "stored readings");
+  control.setSendDisplayReadings();
+  control.setLocalMode();
+  execute();
+  run(SECOND);
+  check(!k197->isRemote() && near(0.5, 1e-5), "displayed readings");
+
+  k197->setSource(sineSource);
+  run(soakSeconds * SECOND);
+
+  double cpuMillis = 1000.0 * (double)(clock() - cpuStart) / CLOCKS_PER_SEC;
+  printf("K197 emulator: %lu measurements, %lu empty frames, %lu control "
+         "frames, %lu handshake timeouts\n",
+         k197->getMeasurementCounter(), k197->getPollCounter(),
+         k197->getControlCounter(), k197->getHandshakeTimeoutCounter());
+  printf("GeminiK197Control: %lu measurements, %lu corrupted, %lu protocol "
+         "errors, %lu handshake timeouts, %lu frame resyncs, %lu frame "
+         "overflows\n",
+         measurements, mismatches, card->getProtocolErrorCounter(),
+         card->getHandshakeTimeoutCounter(), card->getFrameResyncCounter(),
+         card->getFrameOverflowCounter());
+  printf("checks: %lu failed\n", failures);
+  printf("update() called %lu times in %lu steps (%s)\n", updates,
+         sim->getSteps(),
+         scheduled          ? "needsService()"
+         : card->isIdleSleep() ? "every step, idle sleep"
+                               : "every step");
+  if (card->isIdleSleep()) {
+    printf("idle sleep: %lu times, %.1f%% of the time\n",
+           card->getIdleSleepCounter(),
+           100.0 * (double)sim->getSleepMicros() / (double)sim->now());
+  }
+#ifdef GEMINI_HISTOGRAMS
+  GeminiHistograms histograms = card->getHistograms();
+  printHistogram("read delay", histograms.readDelay);
+  printHistogram("ack wait", histograms.ackWait);
+  printHistogram("bit gap", histograms.bitGap);
+  printHistogram("frame duration", histograms.frameDuration);
+#endif // GEMINI_HISTOGRAMS
+  printf("simulated %.1f s in %.1f ms of CPU time (%.0fx real time)\n",
+         (double)sim->now() / SECOND, cpuMillis,
+         cpuMillis > 0 ? (double)sim->now() / (1000.0 * cpuMillis) : 0.0);
+  return (failures != 0 || mismatches != 0 ||
+          measurements != k197->getMeasurementCounter() - skipped)
+             ? 2
+             : 0;
+}
@@ -0,0 +1,306 @@
+/**************************************************************************/
+/*!
+  @file     geminiSim.cpp
+
+  Arduino K197Control library sketch
+
+  Copyright (C) 2023 by ALX2009
+
+  License: MIT (see LICENSE)
+
+  This file is part of the Arduino K197control library, please see
+  https://github.com/alx2009/K197Control for more information
+
+  Note: this file implements the classes GeminiSim and GeminiSimPeer
+*/
+#include <algorithm>
+
+#include "geminiSim.h"
+
+static GeminiSim *currentSim = NULL; ///< the simulation using the HAL hooks
+
+/*!
+     @brief  constructor for the class, with the default parameters
+*/
+GeminiSim::GeminiSim() : GeminiSim(Config()) {}
+
+/*!
+     @brief  constructor for the class, installs the GeminiHal hooks
+     @param config simulation parameters
+*/
+GeminiSim::GeminiSim(const Config &config) : config(config) {
+  rng = config.seed != 0 ? config.seed : 1;
+  for (uint8_t i = 0; i < GEMINI_HOST_PINS; i++) {
+    wire[i] = -1;
+    arrival[i] = 0;
+    listeners[i] = NULL;
+    listenerContext[i] = NULL;
+  }
+  currentSim = this;
+  GeminiHal::setClock(clockHook, delayHook);
+  GeminiHal::setPinHook(pinHook);
+  GeminiHal::setSleepHook(sleepHook);
+}
+
+/*!
+     @brief  destructor for the class, restores the default GeminiHal hooks
+*/
+GeminiSim::~GeminiSim() {
+  if (currentSim == this) {
+    GeminiHal::setClock(NULL, NULL);
+    GeminiHal::setPinHook(NULL);
+    GeminiHal::setSleepHook(NULL);
+    currentSim = NULL;
+  }
+}
+
+/*!
+     @brief  connect an output pin to an input pin
+     @param outputPin the output pin
+     @param inputPin the input pin
+*/
+void GeminiSim::connect(uint8_t outputPin, uint8_t inputPin) {
+  if (outputPin < GEMINI_HOST_PINS && inputPin < GEMINI_HOST_PINS) {
+    wire[outputPin] = (int8_t)inputPin;
+  }
+}
+
+/*!
+     @brief  add a function called at every step
+     @param task the function
+     @param context passed to task
+*/
+void GeminiSim::addTask(Task task, void *context) {
+  tasks.push_back(task);
+  taskContext.push_back(context);
+}
+
+/*!
+     @brief  set a function called when the level of an input pin changes
+     @param inputPin the input pin
+     @param listener the function (NULL = none)
+     @param context passed to listener
+*/
+void GeminiSim::listen(uint8_t inputPin, Listener listener, void *context) {
+  if (inputPin < GEMINI_HOST_PINS) {
+    listeners[inputPin] = listener;
+    listenerContext[inputPin] = context;
+  }
+}
+
+/*!
+     @brief  set the level of a pin after a delay
+     @details if the pin is an output, the change is propagated to the
+   connected input pin (if any)
+     @param pin the pin
+     @param level the new level
+     @param delayMicros the delay (0 = at the next call of advance())
+*/
+void GeminiSim::schedule(uint8_t pin, bool level, unsigned long delayMicros) {
+  Event event = {currentTime + delayMicros, seq++, pin, level};
+  events.push_back(event);
+  std::push_heap(events.begin(), events.end(), later);
+}
+
+/*!
+     @brief  advance the virtual time, applying all the pin changes due
+     @param micros the number of microseconds
+*/
+void GeminiSim::advance(unsigned long micros) {
+  unsigned long target = currentTime + micros;
+  while (!events.empty() && (long)(events.front().time - target) <= 0) {
+    std::pop_heap(events.begin(), events.end(), later);
+    Event event = events.back();
+    events.pop_back();
+    if ((long)(event.time - currentTime) > 0) {
+      currentTime = event.time;
+    }
+    apply(event);
+  }
+  currentTime = target;
+}
+
+/*!
+     @brief  advance the virtual time by one step and call all the tasks
+*/
+void GeminiSim::step() {
+  advance(config.stepMicros + jitter());
+  steps++;
+  for (size_t i = 0; i < tasks.size(); i++) {
+    tasks[i](taskContext[i]);
+  }
+}
+
+/*!
+     @brief  step the simulation for a given time
+     @param micros the number of microseconds
+*/
+void GeminiSim::run(unsigned long micros) {
+  unsigned long start = currentTime;
+  while (currentTime - start < micros) {
+    step();
+  }
+}
+
+/*!
+     @brief  compare two events (heap order)
+     @param a the first event
+     @param b the second event
+     @return true if a must be applied after b
+*/
+bool GeminiSim::later(const Event &a, const Event &b) {
+  long dt = (long)(a.time - b.time);
+  return dt != 0 ? dt > 0 : a.seq > b.seq;
+}
+
+/*!
+     @brief  get a random delay (xorshift generator)
+     @return a delay between 0 and jitterMicros
+*/
+unsigned long GeminiSim::jitter() {
+  if (config.jitterMicros == 0) {
+    return 0;
+  }
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng % (config.jitterMicros + 1);
+}
+
+/*!
+     @brief  apply a pin change
+     @details a rising edge on an input pin raises the edge interrupt of the
+   pin (if any)
+     @param event the pin change
+*/
+void GeminiSim::apply(const Event &event) {
+  bool previous = GeminiHal::readPin(event.pin);
+  GeminiHal::writePin(event.pin, event.level); // calls pinHook() for outputs
+  if (previous == event.level) {
+    return;
+  }
+  if (listeners[event.pin] != NULL) {
+    listeners[event.pin](listenerContext[event.pin], event.level);
+  }
+  int irq = GeminiHal::edgeInterrupt(event.pin);
+  if (event.level && (irq >= 0)) {
+    GeminiHal::raiseEdge(irq);
+  }
+}
+
+/*!
+     @brief  propagate the change of an output pin to the connected input pin
+     @details the changes reach the input pin in the same order they were made,
+   even with jitter
+     @param pin the output pin
+     @param level the new level
+*/
+void GeminiSim::outputChanged(uint8_t pin, bool level) {
+  if (pin >= GEMINI_HOST_PINS || wire[pin] < 0) {
+    return;
+  }
+  uint8_t inputPin = (uint8_t)wire[pin];
+  unsigned long at = currentTime + config.wireDelayMicros + jitter();
+  if ((long)(arrival[inputPin] - at) > 0) {
+    at = arrival[inputPin];
+  }
+  arrival[inputPin] = at;
+  transitions++;
+  schedule(inputPin, level, at - currentTime);
+}
+
+/*!
+     @brief  GeminiHal clock hook
+     @return the virtual time
+*/
+unsigned long GeminiSim::clockHook() {
+  return currentSim != NULL ? currentSim->currentTime : 0;
+}
+
+/*!
+     @brief  GeminiHal delay hook, advances the virtual time
+     @param us the number of microseconds to wait
+*/
+void GeminiSim::delayHook(unsigned long us) {
+  if (currentSim != NULL) {
+    currentSim->advance(us);
+  }
+}
+
+/*!
+     @brief  GeminiHal sleep hook, advances the virtual time to the next pin
+   change or timer tick
+*/
+void GeminiSim::sleepHook() {
+  GeminiSim *sim = currentSim;
+  if (sim == NULL) {
+    return;
+  }
+  unsigned long us = GEMINI_SIM_TIMER_TICK_MICROS -
+                     sim->currentTime % GEMINI_SIM_TIMER_TICK_MICROS;
+  if (!sim->events.empty()) {
+    long next = (long)(sim->events.front().time - sim->currentTime);
+    if (next < (long)us) {
+      us = next > 0 ? (unsigned long)next : 0;
+    }
+  }
+  sim->sleepMicros += us;
+  sim->advance(us);
+}
+
+/*!
+     @brief  GeminiHal pin hook, propagates the output pin changes
+     @param pin the output pin
+     @param value the new level
+*/
+void GeminiSim::pinHook(uint8_t pin, bool value) {
+  if (currentSim != NULL) {
+    currentSim->outputChanged(pin, value);
+  }
+}
+
+/*!
+     @brief  attach the peer to a simulation
+     @details configures the pins, listens to the input pin and calls update()
+   at every step
+     @param newSim the simulation
+*/
+void GeminiSimPeer::attach(GeminiSim &newSim) {
+  sim = &newSim;
+  GeminiHal::pinInput(inputPin);
+  GeminiHal::pinOutput(outputPin, LOW);
+  sim->listen(
+      inputPin,
+      [](void *context, bool level) { ((GeminiSimPeer *)context)->edge(level); },
+      this);
+  sim->addTask([](void *context) { ((GeminiSimPeer *)context)->update(); },
+               this);
+}
+
+/*!
+     @brief  set the level of the output pin
+     @param level the new level
+     @param delayMicros the delay (0 = now)
+*/
+void GeminiSimPeer::drive(bool level, unsigned long delayMicros) {
+  if (delayMicros == 0) {
+    GeminiHal::writePin(outputPin, level);
+  } else {
+    sim->schedule(outputPin, level, delayMicros);
+  }
+}
+
+/*!
+     @brief  generate a pulse (or a rising edge) on the output pin
+     @details the output pin is set HIGH now, and set to finalState after
+   widthMicros. The function does not wait
+     @param widthMicros the duration of the pulse
+     @param finalState if false a pulse is generated. If true a positive edge is
+   generated
+*/
+void GeminiSimPeer::pulse(unsigned long widthMicros, bool finalState) {
+  drive(true);
+  if (!finalState) {
+    drive(false, widthMicros != 0 ? widthMicros : 1);
+  }
+}
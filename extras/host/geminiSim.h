@@ -0,0 +1,216 @@
+/**************************************************************************/
+/*!
+  @file     geminiSim.h
+
+  Arduino K197Control library
+
+  Copyright (C) 2023 by ALX2009
+
+  License: MIT (see LICENSE)
+
+  This file is part of the Arduino K197Display sketch, please see
+  https://github.com/alx2009/K197Control for more information
+
+  This file defines the GeminiSim and GeminiSimPeer classes
+  The GeminiSim class simulates the wires between gemini peers on the host,
+  with a virtual clock, so that the library can be tested and benchmarked
+  without any hardware. Only available in the host build (see geminiHal.h)
+
+*/
+/**************************************************************************/
+#ifndef K197CTRL_GEMINI_SIM_H
+#define K197CTRL_GEMINI_SIM_H
+
+#include <vector>
+
+#include "geminiHal.h"
+
+#ifdef ARDUINO
+#error "geminiSim.h can only be used in the host build"
+#endif // ARDUINO
+
+#define GEMINI_SIM_TIMER_TICK_MICROS                                           \
+  1024 ///< period of the timer interrupt waking a sleeping MCU (see sleepHook)
+
+/*!
+      @brief simulated wires and virtual clock for the gemini protocol
+
+      @details the simulation replaces the clock and the pin hook of
+   GeminiHal. The virtual clock starts at 0 and advances only when the
+   simulation steps (step(), run()) or when a simulated object waits (e.g.
+   GeminiHal::delayMicros() called by pulse()).
+
+      connect() wires an output pin to an input pin. Every change of the output
+   pin reaches the input pin after wireDelayMicros plus a random jitter (up to
+   jitterMicros). A rising edge on an input pin raises the edge interrupt of
+   the pin (GeminiHal::raiseEdge()), a scripted peer can instead listen to the
+   pin (see listen() and GeminiSimPeer).
+
+      Each step advances the clock by stepMicros (plus jitter) and then calls
+   all the tasks, e.g. the update() function of the simulated gemini objects.
+   stepMicros is the simulated loop() period. Note that all the tasks share
+   the same (simulated) CPU: while a task waits in GeminiHal::delayMicros(),
+   the other tasks are not called, but the edge interrupts are still
+   delivered. The same applies to GeminiHal::sleepIdle(): the clock advances
+   to the next pin change or to the next timer tick (every
+   GEMINI_SIM_TIMER_TICK_MICROS, like the Timer0 interrupt on AVR),
+   whichever comes first.
+
+      The random jitter uses a fixed seed, so that a simulation is fully
+   deterministic. Only one GeminiSim object can exist at the same time.
+*/
+class GeminiSim {
+public:
+  typedef void (*Task)(void *context); ///< called at every step
+  typedef void (*Listener)(void *context,
+                           bool level); ///< called when an input pin changes
+
+  /*!
+      @brief simulation parameters
+  */
+  struct Config {
+    unsigned long wireDelayMicros = 1; ///< delay from output to input pin
+    unsigned long jitterMicros = 0;    ///< maximum random extra delay
+    unsigned long stepMicros = 10;     ///< time between two steps
+    uint32_t seed = 1;                 ///< seed of the jitter generator
+  };
+
+  GeminiSim();
+  explicit GeminiSim(const Config &config);
+  ~GeminiSim();
+
+  void connect(uint8_t outputPin, uint8_t inputPin);
+  void addTask(Task task, void *context);
+  void listen(uint8_t inputPin, Listener listener, void *context);
+
+  /*!
+      @brief  add a simulated object, calling its update() function at every
+     step
+      @param endpoint the object (e.g. a GeminiProtocol or GeminiFrame object)
+  */
+  template <class T> void addEndpoint(T &endpoint) {
+    addTask([](void *context) { ((T *)context)->update(); }, &endpoint);
+  };
+
+  void schedule(uint8_t pin, bool level, unsigned long delayMicros);
+
+  /*!
+      @brief  get the virtual time
+      @return the number of microseconds since the start of the simulation
+  */
+  unsigned long now() const { return currentTime; };
+  void advance(unsigned long micros);
+  void step();
+  void run(unsigned long micros);
+
+  /*!
+      @brief  get the number of steps
+      @return the number of steps since the start of the simulation
+  */
+  unsigned long getSteps() const { return steps; };
+  /*!
+      @brief  get the number of pin changes delivered to the input pins
+      @return the number of pin changes since the start of the simulation
+  */
+  unsigned long getTransitions() const { return transitions; };
+  /*!
+      @brief  get the time spent in GeminiHal::sleepIdle()
+      @return the number of microseconds slept since the start of the
+     simulation
+  */
+  unsigned long getSleepMicros() const { return sleepMicros; };
+  /*!
+      @brief  change the time between two steps
+      @param micros the new step (the simulated loop() period)
+  */
+  void setStepMicros(unsigned long micros) { config.stepMicros = micros; };
+
+private:
+  /*!
+      @brief a pin change, applied at a given time
+  */
+  struct Event {
+    unsigned long time; ///< when the change is applied
+    unsigned long seq;  ///< sequence number (events at the same time)
+    uint8_t pin;        ///< the pin
+    bool level;         ///< the new level
+  };
+  static bool later(const Event &a, const Event &b);
+
+  unsigned long jitter();
+  void apply(const Event &event);
+  void outputChanged(uint8_t pin, bool level);
+
+  static unsigned long clockHook();
+  static void delayHook(unsigned long us);
+  static void sleepHook();
+  static void pinHook(uint8_t pin, bool value);
+
+  Config config;                  ///< simulation parameters
+  unsigned long currentTime = 0;  ///< virtual time (microseconds)
+  unsigned long steps = 0;        ///< number of steps
+  unsigned long transitions = 0;  ///< number of pin changes delivered
+  unsigned long sleepMicros = 0;  ///< time spent in GeminiHal::sleepIdle()
+  unsigned long seq = 0;          ///< next event sequence number
+  uint32_t rng;                   ///< state of the jitter generator
+  std::vector<Event> events;      ///< pending pin changes (heap)
+  std::vector<Task> tasks;        ///< tasks, called at every step
+  std::vector<void *> taskContext; ///< task contexts
+
+  int8_t wire[GEMINI_HOST_PINS];              ///< input pin of each output
+  unsigned long arrival[GEMINI_HOST_PINS];    ///< last change of each input
+  Listener listeners[GEMINI_HOST_PINS];       ///< input pin listeners
+  void *listenerContext[GEMINI_HOST_PINS];    ///< listener contexts
+};
+
+/*!
+      @brief base class for a scripted peer, connected to a simulated wire
+
+      @details a scripted peer drives its output pin directly, with no protocol
+   stack. A derived class implements edge() and/or update() and drives the
+   output with drive() and pulse(). pulse() does not wait: the end of the
+   pulse is scheduled in the simulation.
+*/
+class GeminiSimPeer {
+public:
+  /*!
+      @brief  constructor for the class
+      @param inputPin input pin
+      @param outputPin output pin
+  */
+  GeminiSimPeer(uint8_t inputPin, uint8_t outputPin)
+      : inputPin(inputPin), outputPin(outputPin){};
+  virtual ~GeminiSimPeer(){};
+
+  void attach(GeminiSim &newSim);
+
+protected:
+  /*!
+      @brief  called when the level of the input pin changes
+      @param level the new level
+  */
+  virtual void edge(bool level) { (void)level; };
+  /*!
+      @brief  called at every simulation step
+  */
+  virtual void update(){};
+
+  void drive(bool level, unsigned long delayMicros = 0);
+  void pulse(unsigned long widthMicros, bool finalState = false);
+  /*!
+      @brief  read the input pin
+      @return the level of the input pin
+  */
+  bool input() const { return GeminiHal::readPin(inputPin); };
+  /*!
+      @brief  get the virtual time
+      @return the number of microseconds since the start of the simulation
+  */
+  unsigned long now() const { return sim->now(); };
+
+  GeminiSim *sim = NULL; ///< the simulation (set by attach())
+  uint8_t inputPin;      ///< input pin
+  uint8_t outputPin;     ///< output pin
+};
+
+#endif // K197CTRL_GEMINI_SIM_H
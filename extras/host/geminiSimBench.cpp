@@ -0,0 +1,172 @@
+/**************************************************************************/
+/*!
+  @file     geminiSimBench.cpp
+
+  Arduino K197Control library sketch
+
+  Copyright (C) 2023 by ALX2009
+
+  License: MIT (see LICENSE)
+
+  This file is part of the Arduino K197control library, please see
+  https://github.com/alx2009/K197Control for more information
+
+  Note: this file is a host program measuring the throughput and the frame
+  latency of the gemini protocol, using two GeminiFrame objects connected by
+  a simulated wire (see README.md in this directory)
+
+  Usage: geminiSimBench [writePulse readDelay writeDelay [jitter [step
+  [frames]]]] (all times in microseconds). When compiled with
+  -DGEMINI_TRACE_SIZE=128, the trace of the receiver is also printed (see
+  geminiTraceDecode.cpp)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "geminiFrame.h"
+#include "geminiSim.h"
+
+#define SENDER_INPUT_PIN 2   ///< input pin of the sender (initiator)
+#define SENDER_OUTPUT_PIN 3  ///< output pin of the sender (initiator)
+#define RECEIVER_INPUT_PIN 4  ///< input pin of the receiver
+#define RECEIVER_OUTPUT_PIN 5 ///< output pin of the receiver
+
+#define FRAME_BYTES 4    ///< bytes in each frame (same as a K197 measurement)
+#define SYNC_ZEROS 16    ///< zeros sent before each frame
+#define FRAME_TIMEOUT 5000UL ///< frame timeout (microseconds)
+
+static unsigned long firstEdge = 0; ///< time of the first edge of the frame
+static bool frameStarted = false;   ///< true after the first edge
+
+/*!
+     @brief  record the time of the first edge of a frame
+     @param context the simulation
+     @param level the level of the receiver input pin
+*/
+static void receiverEdge(void *context, bool level) {
+  GeminiSim *sim = (GeminiSim *)context;
+  if (level && !frameStarted) {
+    frameStarted = true;
+    firstEdge = sim->now();
+  }
+}
+
+#ifdef GEMINI_TRACE_SIZE
+/*!
+     @brief  print the trace records of a gemini object
+     @param endpoint the gemini object
+*/
+static void printTrace(GeminiFrame &endpoint) {
+  char line[GEMINI_TRACE_LINE_SIZE];
+  GeminiTraceRecord record;
+  while (endpoint.getTrace().pull(record)) {
+    printf("%s\n", record.format(line));
+  }
+}
+#endif // GEMINI_TRACE_SIZE
+
+/*!
+     @brief  get an optional argument
+     @param argc number of arguments
+     @param argv arguments
+     @param i index of the argument
+     @param value default value
+     @return the value of the argument, or value if not present
+*/
+static unsigned long arg(int argc, char **argv, int i, unsigned long value) {
+  return argc > i ? strtoul(argv[i], NULL, 10) : value;
+}
+
+int main(int argc, char **argv) {
+  unsigned long writePulse = arg(argc, argv, 1, 10);
+  unsigned long readDelay = arg(argc, argv, 2, 170);
+  unsigned long writeDelay = arg(argc, argv, 3, 90);
+  GeminiSim::Config config;
+  config.jitterMicros = arg(argc, argv, 4, 0);
+  config.stepMicros = arg(argc, argv, 5, 10);
+  unsigned long frames = arg(argc, argv, 6, 100);
+
+  GeminiSim sim(config);
+  GeminiFrame sender(SENDER_INPUT_PIN, SENDER_OUTPUT_PIN, writePulse, 10000,
+                     readDelay, writeDelay);
+  GeminiFrame receiver(RECEIVER_INPUT_PIN, RECEIVER_OUTPUT_PIN, writePulse,
+                       10000, readDelay, writeDelay);
+  uint8_t frame[FRAME_BYTES];
+  if (!sender.begin() || !receiver.begin(frame, FRAME_BYTES)) {
+    return 1;
+  }
+  sender.setFrameSync(true, FRAME_TIMEOUT);
+  receiver.setFrameSync(true, FRAME_TIMEOUT);
+  receiver.setInitiatorMode(false);
+  sim.connect(SENDER_OUTPUT_PIN, RECEIVER_INPUT_PIN);
+  sim.connect(RECEIVER_OUTPUT_PIN, SENDER_INPUT_PIN);
+  sim.listen(RECEIVER_INPUT_PIN, receiverEdge, &sim);
+  sim.addEndpoint(sender);
+  sim.addEndpoint(receiver);
+
+  clock_t cpuStart = clock();
+  unsigned long errors = 0;
+  unsigned long wireMicros = 0;
+  unsigned long latencyMicros = 0;
+  unsigned long maxLatencyMicros = 0;
+  unsigned long completed = 0;
+  for (unsigned long n = 0; n < frames; n++) {
+    uint8_t data[FRAME_BYTES];
+    for (uint8_t i = 0; i < FRAME_BYTES; i++) {
+      data[i] = (uint8_t)(n * FRAME_BYTES + i);
+    }
+    frameStarted = false;
+    unsigned long sendTime = sim.now();
+    sender.sendBits(0, SYNC_ZEROS);
+    sender.sendFrame(data, FRAME_BYTES);
+    unsigned long timeout = sendTime + 10 * FRAME_TIMEOUT + 1000000UL;
+    while (!receiver.frameComplete() && (long)(sim.now() - timeout) < 0) {
+      sim.step();
+      while (sender.hasData()) { // discard the acknowledge bits
+        sender.receive();
+      }
+#ifdef GEMINI_TRACE_SIZE
+      printTrace(receiver);
+#endif // GEMINI_TRACE_SIZE
+    }
+    if (!receiver.frameComplete()) {
+      errors++;
+      continue;
+    }
+    unsigned long latency = sim.now() - sendTime;
+    latencyMicros += latency;
+    maxLatencyMicros = latency > maxLatencyMicros ? latency : maxLatencyMicros;
+    wireMicros += sim.now() - firstEdge;
+    completed++;
+    for (uint8_t i = 0; i < FRAME_BYTES; i++) {
+      if (frame[i] != data[i]) {
+        errors++;
+        break;
+      }
+    }
+    receiver.resetFrame();
+  }
+  double cpuMillis = 1000.0 * (double)(clock() - cpuStart) / CLOCKS_PER_SEC;
+
+  unsigned long bits = completed * (SYNC_ZEROS + 9 * FRAME_BYTES);
+  printf("timing: writePulse=%lu readDelay=%lu writeDelay=%lu jitter=%lu "
+         "step=%lu (us)\n",
+         writePulse, readDelay, writeDelay, config.jitterMicros,
+         config.stepMicros);
+  printf("frames: %lu sent, %lu received, %lu errors\n", frames, completed,
+         errors);
+  if (completed > 0) {
+    printf("throughput: %.0f bits/s on the wire\n",
+           1e6 * (double)bits / (double)wireMicros);
+    printf("frame latency: %lu us average, %lu us max\n",
+           latencyMicros / completed, maxLatencyMicros);
+  }
+  printf("protocol errors: %lu, handshake timeouts: %lu\n",
+         sender.getProtocolErrorCounter() + receiver.getProtocolErrorCounter(),
+         sender.getHandshakeTimeoutCounter() +
+             receiver.getHandshakeTimeoutCounter());
+  printf("simulated %lu us in %.1f ms of CPU time (%lu steps)\n", sim.now(),
+         cpuMillis, sim.getSteps());
+  return errors != 0 ? 2 : 0;
+}
@@ -0,0 +1,213 @@
+/**************************************************************************/
+/*!
+  @file     geminiTraceDecode.cpp
+
+  Arduino K197Control library sketch
+
+  Copyright (C) 2023 by ALX2009
+
+  License: MIT (see LICENSE)
+
+  This file is part of the Arduino K197control library, please see
+  https://github.com/alx2009/K197Control for more information
+
+  Note: this file is a host program decoding the trace records printed by
+  GeminiTraceT::dump() (see geminiTrace.h). It reconstructs the timeline of
+  the state transitions and the frames exchanged with the peer (see README.md
+  in this directory)
+
+  Usage: geminiTraceDecode [-f] < capture.txt (lines not starting with '~'
+  are ignored, so the output of the Serial monitor can be used as is). With
+  -f only the frames are printed
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "geminiTrace.h"
+
+#define MAX_FRAME_BITS 1024 ///< bits stored for each frame
+#define LINE_SIZE 256       ///< maximum line length
+
+static const char *const stateNames[] = {
+    "IDLE", "BIT_READ_START", "BIT_WRITE_WAIT_ACK",
+    "BIT_WRITE_END"}; ///< GeminiProtocolT states
+static const char *const frameStateNames[] = {
+    "WAIT_FRAME_START", "WAIT_FRAME_DATA", "FRAME_END",
+    "?"}; ///< GeminiFrameT states
+
+/*!
+      @brief the bits exchanged in a frame
+*/
+struct Frame {
+  unsigned long start = 0; ///< time of the first transition
+  unsigned long last = 0;  ///< time of the last transition
+  bool started = false;    ///< at least one bit transition recorded
+  bool incomplete = false; ///< records lost or transfer aborted
+  char read[MAX_FRAME_BITS + 1];    ///< bits read ('0'/'1')
+  char written[MAX_FRAME_BITS + 1]; ///< bits written ('0'/'1')
+  size_t nread = 0;                 ///< number of bits read
+  size_t nwritten = 0;              ///< number of bits written
+};
+
+/*!
+     @brief  print a sequence of bits decoded as sub-frames
+     @details the 0 bits before a start bit are counted, the 8 bits after a
+   start bit are a data byte (MSB first), as in the gemini frame protocol
+     @param label the name of the sequence
+     @param bits the bits ('0'/'1')
+     @param n the number of bits
+*/
+static void printBits(const char *label, const char *bits, size_t n) {
+  if (n == 0) {
+    return;
+  }
+  printf("  %-8s %.*s\n", label, (int)n, bits);
+  printf("  %-8s", "");
+  size_t i = 0;
+  while (i < n) {
+    size_t zeros = 0;
+    while (i < n && bits[i] == '0') {
+      zeros++;
+      i++;
+    }
+    if (zeros > 0) {
+      printf(" %lu zeros", (unsigned long)zeros);
+    }
+    if (i >= n) {
+      break;
+    }
+    i++; // start bit
+    if (i + 8 > n) {
+      printf(" partial(%lu bits)", (unsigned long)(n - i));
+      break;
+    }
+    unsigned value = 0;
+    for (size_t j = 0; j < 8; j++) {
+      value = (value << 1) | (bits[i++] == '1' ? 1 : 0);
+    }
+    printf(" [%02x]", value);
+  }
+  printf("\n");
+}
+
+/*!
+     @brief  print and reset the current frame
+     @param frame the frame
+     @param reason why the frame ended
+*/
+static void endFrame(Frame &frame, const char *reason) {
+  if (frame.started) {
+    size_t bits = frame.nread > frame.nwritten ? frame.nread : frame.nwritten;
+    printf("frame at %lu us: %lu us, %lu bits read, %lu bits written%s "
+           "(%s)\n",
+           frame.start, frame.last - frame.start, (unsigned long)frame.nread,
+           (unsigned long)frame.nwritten,
+           frame.incomplete ? ", INCOMPLETE" : "", reason);
+    if (bits > 1) {
+      printf("  %lu us per bit\n",
+             (frame.last - frame.start) / (unsigned long)(bits - 1));
+    }
+    printBits("read:", frame.read, frame.nread);
+    printBits("written:", frame.written, frame.nwritten);
+  }
+  frame = Frame();
+}
+
+int main(int argc, char **argv) {
+  bool framesOnly = (argc > 1) && (strcmp(argv[1], "-f") == 0);
+  char line[LINE_SIZE];
+  unsigned long time = 0;
+  unsigned long records = 0;
+  Frame frame;
+  while (fgets(line, sizeof(line), stdin) != NULL) {
+    const char *p = strchr(line, '~');
+    GeminiTraceRecord record;
+    if (p == NULL || !record.parse(p)) {
+      continue;
+    }
+    records++;
+    if (record.lostBefore()) {
+      frame.incomplete = true;
+      if (!framesOnly) {
+        printf("--- records lost ---\n");
+      }
+    }
+    unsigned long delta = record.getDeltaMicros();
+    time += delta;
+    GeminiTraceRecord::Event event = record.getEvent();
+    uint8_t oldState = record.getOldState();
+    uint8_t newState = record.getNewState();
+    bool bitRead = (event == GeminiTraceRecord::STATE) && (oldState == 1);
+    bool bitWritten = (event == GeminiTraceRecord::STATE) && (newState == 2);
+
+    if (event == GeminiTraceRecord::STATE) {
+      if (!frame.started) {
+        frame.started = true;
+        frame.start = time;
+      }
+      frame.last = time;
+      if (bitRead && frame.nread < MAX_FRAME_BITS) {
+        frame.read[frame.nread++] =
+            (record.levels & GEMINI_TRACE_BIT_READ) ? '1' : '0';
+      }
+      if (bitWritten && frame.nwritten < MAX_FRAME_BITS) {
+        frame.written[frame.nwritten++] =
+            (record.levels & GEMINI_TRACE_BIT_WRITTEN) ? '1' : '0';
+      }
+    }
+
+    if (!framesOnly) {
+      if (record.delta == 0xffff) {
+        printf("%12s +>33.5s  ", "?");
+      } else {
+        printf("%12lu +%-7lu ", time, delta);
+      }
+      switch (event) {
+      case GeminiTraceRecord::STATE:
+        printf("%s -> %s", stateNames[oldState], stateNames[newState]);
+        break;
+      case GeminiTraceRecord::FRAME_END:
+        printf("frame end");
+        break;
+      case GeminiTraceRecord::ABORT:
+        printf("abort in %s", stateNames[oldState]);
+        break;
+      case GeminiTraceRecord::FRAME_STATE:
+        printf("frame %s -> %s", frameStateNames[oldState],
+               frameStateNames[newState]);
+        break;
+      case GeminiTraceRecord::FRAME_RESYNC:
+        printf("frame resync");
+        break;
+      case GeminiTraceRecord::FRAME_TIMEOUT:
+        printf("frame timeout");
+        break;
+      default:
+        printf("unknown event %u", (unsigned)event);
+        break;
+      }
+      printf("  in=%d out=%d end=%d",
+             (record.levels & GEMINI_TRACE_INPUT) ? 1 : 0,
+             (record.levels & GEMINI_TRACE_OUTPUT) ? 1 : 0,
+             (record.levels & GEMINI_TRACE_FRAME_END) ? 1 : 0);
+      if (bitRead) {
+        printf(" read=%d", (record.levels & GEMINI_TRACE_BIT_READ) ? 1 : 0);
+      }
+      if (bitWritten) {
+        printf(" wrote=%d",
+               (record.levels & GEMINI_TRACE_BIT_WRITTEN) ? 1 : 0);
+      }
+      printf("\n");
+    }
+
+    if (event == GeminiTraceRecord::FRAME_END) {
+      endFrame(frame, "frame end");
+    } else if (event == GeminiTraceRecord::ABORT) {
+      frame.incomplete = true;
+      endFrame(frame, "aborted");
+    }
+  }
+  endFrame(frame, "end of trace");
+  printf("%lu records\n", records);
+  return records > 0 ? 0 : 1;
+}
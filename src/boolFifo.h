@@ -18,25 +18,54 @@
 #ifndef K197CTRL_BOOL_FIFO_H
 #define K197CTRL_BOOL_FIFO_H
 
-// Define the maximum size of the FIFO queues
+// Define the maximum size of the FIFO queues, in bits
 // Tested only with a size greater than the maximum frame lenght expected
 // including synchronization sequence(s) and stop bits. Should work
 // with smaller buffer if data read frequently enough, but not tested
-#define FIFO_SIZE 64               ///< default size of the FIFO
-#define INPUT_FIFO_SIZE FIFO_SIZE  ///< size of the input FIFO
-#define OUTPUT_FIFO_SIZE FIFO_SIZE ///< size of the output FIFO
+// GeminiProtocol::getStats() can be used to check the actual usage
+// Since bits are packed 8 per byte, a FIFO uses FIFO_SIZE/8 bytes of RAM
+// All sizes must be a power of two, and at least 8
+#define FIFO_SIZE 64               ///< default size of the FIFO (bits)
+#define INPUT_FIFO_SIZE FIFO_SIZE  ///< size of the input FIFO (bits)
+#define OUTPUT_FIFO_SIZE FIFO_SIZE ///< size of the output FIFO (bits)
+
+/*!
+      @brief statistics collected by a boolFifo object
+*/
+struct boolFifoStats {
+  size_t highWater = 0; ///< maximum number of bits stored at the same time
+  unsigned long overflows = 0; ///< number of bits dropped since FIFO full
+  unsigned long underflows =
+      0; ///< number of bits requested (pulled) when not available
+};
 
 /*!
       @brief define a class implementing a FIFO buffer
 
       @details Records can be pushed to the tail and pulled from the head of the
-   buffer, first in first out(FIFO) A bool is used to represent a single bit
-   value (0= false, 1= true).
-      TODO: could be improved to pack 8 bools in one bit, right now we waste a
-   lot of RAM
+   buffer, first in first out(FIFO). Each record is a single bit (0= false, 1=
+   true).
+
+      The capacity N (in bits) is defined at compile time and must be a power
+   of two (at least 8), so that head and tail can wrap around with a mask
+   instead of a (slow) division.
+
+      Bits are packed 8 per byte in a ring buffer, head and tail are bit indexes
+   into the ring. Within a byte, bits are stored starting from the MSB. A FIFO
+   of N bits uses N/8 bytes of RAM.
+
+      The FIFO keeps track of the maximum number of bits stored (high water
+   mark) and of bits lost due to overflow or underflow, see getStats().
+
+      @tparam N the capacity of the FIFO in bits
 */
-class boolFifo {
+template <size_t N = FIFO_SIZE> class boolFifo {
+  static_assert(N >= 8 && (N & (N - 1)) == 0,
+                "boolFifo size must be a power of two, at least 8");
+
 public:
+  static const size_t capacity = N; ///< the capacity of the FIFO in bits
+
   /*!
       @brief  constructor for the class. After construction the FIFO is empty.
   */
@@ -49,12 +78,21 @@ public:
      full)
   */
   bool push(bool value) {
-    if (count >= FIFO_SIZE) {
+    if (count >= N) {
+      stats.overflows++;
       return false; // FIFO is full
     }
-    buffer[tail] = value;
-    tail = (tail + 1) % FIFO_SIZE;
+    uint8_t mask = 0x80 >> (tail & 0x07);
+    if (value) {
+      buffer[tail >> 3] |= mask;
+    } else {
+      buffer[tail >> 3] &= ~mask;
+    }
+    tail = (tail + 1) & (N - 1);
     count++;
+    if (count > stats.highWater) {
+      stats.highWater = count;
+    }
     return true;
   };
 
@@ -65,14 +103,135 @@ public:
   */
   bool pull() {
     if (count <= 0) {
+      stats.underflows++;
       return false; // FIFO is empty
     }
-    bool value = buffer[head];
-    head = (head + 1) % FIFO_SIZE;
+    bool value = (buffer[head >> 3] & (0x80 >> (head & 0x07))) != 0;
+    head = (head + 1) & (N - 1);
     count--;
     return value;
   };
 
+  /*!
+      @brief  store up to 32 bits in the FIFO if there is space left
+      @details the n least significant bits of value are pushed at the tail of
+     the FIFO, starting from the most significant one (bit n-1 is pushed first,
+     bit 0 last). This is equivalent to calling push() n times, but the bits
+     are moved up to 8 at a time.
+      @param value the bits that should be pushed at the tail of the FIFO
+      @param n the number of bits to push (0 to 32)
+      @return true if all the bits were stored correctly, false otherwise (not
+     enough space in the FIFO, no bit is stored in such a case)
+  */
+  bool pushBits(uint32_t value, uint8_t n) {
+    if ((n > 32) || (n > N - count)) {
+      stats.overflows += n;
+      return false; // not enough space in the FIFO
+    }
+    count += n;
+    if (count > stats.highWater) {
+      stats.highWater = count;
+    }
+    while (n > 0) {
+      uint8_t offset = tail & 0x07;
+      uint8_t k = 8 - offset; // bits left in the current byte
+      if (k > n) {
+        k = n;
+      }
+      uint8_t shift = 8 - offset - k;
+      uint8_t mask = ((1 << k) - 1) << shift;
+      uint8_t chunk = (uint8_t)(value >> (n - k)) << shift;
+      buffer[tail >> 3] = (buffer[tail >> 3] & ~mask) | (chunk & mask);
+      tail = (tail + k) & (N - 1);
+      n -= k;
+    }
+    return true;
+  };
+
+  /*!
+      @brief  removes up to 32 bits from the head of the FIFO and returns them
+     to the caller
+      @details the first bit pulled is returned as bit n-1, the last as bit 0.
+     This is equivalent to calling pull() n times, but the bits are moved up to
+     8 at a time.
+      @param n the number of bits to pull (0 to 32)
+      @return the oldest n bits still stored, or 0 if less than n bits are
+     stored (no bit is removed in such a case)
+  */
+  uint32_t pullBits(uint8_t n) {
+    if ((n > 32) || (n > count)) {
+      stats.underflows += n;
+      return 0; // not enough data in the FIFO
+    }
+    count -= n;
+    uint32_t value = 0;
+    while (n > 0) {
+      uint8_t offset = head & 0x07;
+      uint8_t k = 8 - offset; // bits left in the current byte
+      if (k > n) {
+        k = n;
+      }
+      uint8_t chunk = (buffer[head >> 3] >> (8 - offset - k)) & ((1 << k) - 1);
+      value = (value << k) | chunk;
+      head = (head + k) & (N - 1);
+      n -= k;
+    }
+    return value;
+  };
+
+  /*!
+      @brief  find the first bit set to 1 (true) in the FIFO
+      @details the FIFO is scanned starting from the head, one byte at a time.
+     No data is removed from the FIFO.
+      @return the number of bits set to 0 (false) before the first bit set to 1
+     (true). If no bit is set to 1, the number of bits in the FIFO.
+  */
+  size_t findFirstSet() const {
+    size_t index = head;
+    size_t offset = 0;
+    while (offset < count) {
+      uint8_t bitOffset = index & 0x07;
+      uint8_t bits = buffer[index >> 3] << bitOffset; // next bit in the MSB
+      uint8_t k = 8 - bitOffset; // bits left in the current byte
+      if (k > count - offset) {
+        k = count - offset;
+        bits &= (uint8_t)(0xff << (8 - k)); // ignore bits past the tail
+      }
+      if (bits != 0) {
+        while ((bits & 0x80) == 0) {
+          bits <<= 1;
+          offset++;
+        }
+        return offset;
+      }
+      offset += k;
+      index = (index + k) & (N - 1);
+    }
+    return count;
+  };
+
+  /*!
+      @brief  remove a sequence of bits set to 0 (false) from the head of the
+     FIFO
+      @details the bits are removed up to the first bit set to 1 (true), which
+     is left at the head of the FIFO. If no bit is set to 1 the FIFO is emptied.
+      @return the number of bits removed
+  */
+  size_t skipZeros() {
+    size_t n = findFirstSet();
+    head = (head + n) & (N - 1);
+    count -= n;
+    return n;
+  };
+
+  /*!
+      @brief  remove all the data stored in the FIFO
+  */
+  void flush() {
+    head = tail;
+    count = 0;
+  };
+
   /*!
       @brief  check if the buffer is empty
       @return true if empty, false otherwise
@@ -83,7 +242,7 @@ public:
       @brief  check if the buffer is full
       @return true if full, false otherwise
   */
-  bool full() const { return count == FIFO_SIZE; }
+  bool full() const { return count == N; }
 
   /*!
       @brief  get the number of records stored in the FIFO
@@ -91,11 +250,30 @@ public:
   */
   size_t size() const { return count; };
 
+  /*!
+      @brief  get the statistics collected since construction or the last
+     call to resetStats()
+      @return the FIFO statistics
+  */
+  const boolFifoStats &getStats() const { return stats; };
+
+  /*!
+      @brief  reset the statistics
+      @details the high water mark is set to the number of bits currently
+     stored, the overflow and underflow counters are set to 0
+  */
+  void resetStats() {
+    stats.highWater = count;
+    stats.overflows = 0;
+    stats.underflows = 0;
+  };
+
 private:
-  bool buffer[FIFO_SIZE]; ///< the FIFO buffer itself
-  size_t head = 0;        ///< index to the head of the FIFO buffer
-  size_t tail = 0;        ///< index to the tail of the FIFO buffer
-  size_t count = 0;       ///< count how many elements are stored in the FIFO
+  uint8_t buffer[N / 8]; ///< the FIFO buffer, 8 bits per byte
+  size_t head = 0;  ///< bit index to the head of the FIFO buffer
+  size_t tail = 0;  ///< bit index to the tail of the FIFO buffer
+  size_t count = 0; ///< count how many bits are stored in the FIFO
+  boolFifoStats stats; ///< statistics (high water mark, overflow, underflow)
 };
 
 #endif // K197CTRL_BOOL_FIFO_H
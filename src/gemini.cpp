@@ -11,257 +11,173 @@
   This file is part of the Arduino K197control library, please see
   https://github.com/alx2009/K197Control for more information
 
-  Note: this file implements the class geminiProtocol
+  Note: this file implements the interrupt handlers used by the class
+  GeminiProtocolT (the class itself is a template, implemented in gemini.h)
 */
-#include <Arduino.h>
-
 #include "gemini.h"
 
-volatile bool inputEdgeDetected = false; ///< flag, set in the interrupt handler
+#ifndef GEMINI_EDGE_INTERRUPTS
+#error "GEMINI_EDGE_INTERRUPTS is not defined (see geminiHal.h)"
+#endif
+static_assert(GEMINI_EDGE_INTERRUPTS > 0,
+              "at least one edge interrupt is required (see geminiHal.h)");
+
+/*!
+     @brief  edge detectors attached to each external interrupt
+*/
+static GeminiEdgeDetector *volatile edgeDetectors[GEMINI_EDGE_INTERRUPTS];
+
 /*!
-     @brief  interrupt handler.
+     @brief  interrupt handler (trampoline).
 
      @details this is the interrupt detecting the rising edge on the input pin
-     when begin() is called, this handler is attached to the input pin with
-   attachInterrupt()
+     of a gemini object. There is one instance for each external interrupt,
+   calling the edge detector attached to that interrupt
+     @tparam IRQ the interrupt number
+*/
+template <uint8_t IRQ> static void risingEdgeInterrupt() {
+  GeminiEdgeDetector *edge = edgeDetectors[IRQ];
+  if (edge != NULL) {
+    edge->interrupt();
+  }
+}
 
+/*!
+     @brief  interrupt handlers, indexed by interrupt number
 */
-void risingEdgeInterrupt() { inputEdgeDetected = true; }
+static void (*const risingEdgeInterrupts[])() = {
+    risingEdgeInterrupt<0>,
+#if GEMINI_EDGE_INTERRUPTS > 1
+    risingEdgeInterrupt<1>,
+#endif
+#if GEMINI_EDGE_INTERRUPTS > 2
+    risingEdgeInterrupt<2>,
+#endif
+#if GEMINI_EDGE_INTERRUPTS > 3
+    risingEdgeInterrupt<3>,
+#endif
+#if GEMINI_EDGE_INTERRUPTS > 4
+    risingEdgeInterrupt<4>,
+#endif
+#if GEMINI_EDGE_INTERRUPTS > 5
+    risingEdgeInterrupt<5>,
+#endif
+#if GEMINI_EDGE_INTERRUPTS > 6
+    risingEdgeInterrupt<6>,
+#endif
+#if GEMINI_EDGE_INTERRUPTS > 7
+    risingEdgeInterrupt<7>,
+#endif
+#if GEMINI_EDGE_INTERRUPTS > 8
+#error "too many external interrupts, please add more interrupt handlers"
+#endif
+};
 
 /*!
-     @brief  initialize the object.
+     @brief  attach the edge detector to the interrupt of the input pin
 
-     @details It should be called before using the object
+     @details the rising edge interrupt of the input pin is enabled, calling
+   interrupt() for this object. Only one detector can be attached to a given
+   interrupt.
 
      PREREQUISITES: Serial.begin must be called to see any error message
-     @return true if the call was succesful and the object can be used, false
-   otherwise
+     @param inputPin the input pin. Must be able to detect an edge interrupt
+     @param newCallback if not NULL, also called in interrupt context for each
+   edge
+     @param newContext passed to newCallback
+     @return true if the call was succesful, false otherwise
 */
-bool GeminiProtocol::begin() {
-  if (digitalPinToInterrupt(inputPin) == NOT_AN_INTERRUPT) {
-    Serial.print(F("Error: Pin "));
-    Serial.print(inputPin);
-    Serial.println(F(" does not support interrupts!"));
+bool GeminiEdgeDetector::attach(uint8_t inputPin, Callback newCallback,
+                                void *newContext) {
+  int irq = GeminiHal::edgeInterrupt(inputPin);
+  if (irq < 0) {
+    GeminiHal::pinError(inputPin, GEMINI_STR(" does not support interrupts!"));
+    return false;
+  }
+  if (edgeDetectors[irq] != NULL && edgeDetectors[irq] != this) {
+    GeminiHal::pinError(inputPin, GEMINI_STR(" is already used!"));
     return false;
   }
-  digitalWrite(outputPin, LOW);
-  pinMode(inputPin, INPUT);
-  pinMode(outputPin, OUTPUT);
-  digitalWrite(outputPin, LOW);
-  state = State::IDLE;
-#ifdef DEBUG_PORT      // Make sure the following pins match the definition of
-                       // DEBUG_PORT above!
-  pinMode(A0, OUTPUT); // TODO: use direct port manipulation so the above is
-                       // always verified...
-  pinMode(A1, OUTPUT);
-  pinMode(A2, OUTPUT);
-  DEBUG_STATE();
-  DEBUG_FRAME_END();
-#endif // DEBUG_PORT
-  lastBitReadTime = 0L;
-  attachInterrupt(digitalPinToInterrupt(inputPin), risingEdgeInterrupt, RISING);
+  detach();
+  GEMINI_CRITICAL_SECTION() {
+    callback = newCallback;
+    context = newContext;
+    count = 0;
+    interruptNumber = irq;
+    edgeDetectors[irq] = this;
+  }
+  GeminiHal::attachRisingEdge(irq, risingEdgeInterrupts[irq]);
   return true;
 }
 
+#ifdef GEMINI_USE_TIMER1
 /*!
-     @brief  main input/output handler
-
-     @details in this function we update the internal state machine, reading and
-   writing data as required by the first layer of the gemini protocol
-   specification
-
-     The gemini protocol does not require a strict timing at eitehr side,
-   however update() should be called as often as possible (at least once every
-   loop() iteraction) to achieve maximum possible throughput and lowest possible
-   latency
-
-     If this function is not called for a significant amount of time, the
-   protocol may time-out and abort the current frame transmission
+     @brief  input capture handler, calls the edge detector
+     @param context the edge detector
+     @param ticks the Timer1 count captured at the time of the edge
 */
-void GeminiProtocol::update() {
-  unsigned long currentTime = micros();
-
-  switch (state) {
-  case State::IDLE:
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-      if (inputEdgeDetected) {
-        isInitiator = false;
-        frameEndDetected = false;
-        state = State::BIT_READ_START;
-        DEBUG_STATE();
-        DEBUG_FRAME_END();
-        lastBitReadTime = currentTime;
-        inputEdgeDetected = false; // Reset the flag atomically
-        break;
-      }
-    }
-    if (frameEndDetected) {
-      if (canBeInitiator && (outputBuffer.size() > 0)) {
-        isInitiator = true;
-        fast_write(HIGH);
-        delayMicroseconds(writePulseMicros);
-        bool bitToSend = outputBuffer.pull();
-        fast_write(bitToSend);
-        frameEndDetected = false;
-        state = State::BIT_WRITE_WAIT_ACK;
-        DEBUG_STATE();
-        DEBUG_FRAME_END();
-        lastBitReadTime = currentTime;
-      }
-    } else if (currentTime - lastBitReadTime >= frameTimeout) {
-      frameEndDetected = true;
-      DEBUG_FRAME_END();
-    }
-    break;
-  case State::BIT_READ_START:
-    if (currentTime - lastBitReadTime >= readDelayMicros) {
-      bool bitValue = fast_read();
-      inputBuffer.push(bitValue);
-
-      if (outputBuffer.empty()) {
-        if (isInitiator) { // we need to stop here
-          ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-            fast_write(LOW);           // Just to be sure...
-            inputEdgeDetected = false; // just to be sure...
-            isInitiator = false;       // just to be sure...
-            state = State::IDLE;
-          }
-        } else { // must send an acknowledge
-          fast_write(HIGH);
-          delayMicroseconds(writePulseMicros);
-          fast_write(false);
-          state = State::IDLE;
-        }
-      } else { // if we have data to send, we cannot stop until we have sent it
-               // all...
-        fast_write(HIGH);
-        delayMicroseconds(writePulseMicros);
-        bool bitToSend = outputBuffer.pull();
-        fast_write(bitToSend);
-        state = State::BIT_WRITE_WAIT_ACK;
-      }
-      DEBUG_STATE();
-      lastBitReadTime = currentTime;
-    }
-    break;
-
-  case State::BIT_WRITE_WAIT_ACK:
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-      if (inputEdgeDetected) {
-        state = State::BIT_WRITE_END;
-        lastBitReadTime = currentTime;
-        DEBUG_STATE();
-        inputEdgeDetected = false; // Reset the flag atomically
-      }
-    }
-    break;
-
-  case State::BIT_WRITE_END:
-    if (currentTime - lastBitReadTime >= writeDelayMicros) {
-      fast_write(false);
-      state = State::BIT_READ_START;
-      lastBitReadTime = currentTime;
-      DEBUG_STATE();
-    }
-    break;
-
-  default:
-    break;
-  }
+static void captureInterrupt(void *context, uint16_t ticks) {
+  ((GeminiEdgeDetector *)context)->captureInterrupt(ticks);
 }
 
 /*!
-     @brief  wait for a positive edge on the input pin
-
-     @details this is a helper function that waits for a transition on the input
-   pin This function will block until a positive edge is detected on the input
-   pin or a timeout occurs. Only interrupt handlers are running while this
-   function is waiting.
-
-     Note that this function will reset the edge detection, so the next update()
-   will not detect the same input edge. This is by design.
+     @brief  attach the edge detector to the Timer1 input capture unit
 
-     This function is not required at all to imnplement the gemini protocol, but
-   it can be useful in special circumstances. For example, at startup an
-   application may want to display an error message if the peer is not running.
+     @details the rising edges on the ICP1 pin (GEMINI_ICP1_PIN) are
+   timestamped by the hardware, calling captureInterrupt() for this object.
+   Only one detector can be attached to the input capture unit.
 
-     @param timeout_micros timeout in microseconds
-     @return true if an edge was detected, false if the function returns due to
-   timeout
+     PREREQUISITES: Serial.begin must be called to see any error message
+     @param inputPin the input pin. Must be GEMINI_ICP1_PIN
+     @param newCallback if not NULL, also called in interrupt context for each
+   edge
+     @param newContext passed to newCallback
+     @return true if the call was succesful, false otherwise
 */
-bool GeminiProtocol::waitInputEdge(unsigned long timeout_micros) {
-  unsigned long currentTime = micros();
-  unsigned long waitStartTime = currentTime;
-  volatile bool wait = true;
-  while (wait) {
-    currentTime = micros();
-    delayMicroseconds(4);
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-      if (inputEdgeDetected) {
-        wait = false;
-        inputEdgeDetected = false;
-      }
-    }
-    if (currentTime - waitStartTime >= timeout_micros) {
-      return false;
-    }
+bool GeminiEdgeDetector::attachCapture(uint8_t inputPin, Callback newCallback,
+                                       void *newContext) {
+  bool capturePin = false;
+#ifdef GEMINI_ICP1_PIN
+  capturePin = (inputPin == GEMINI_ICP1_PIN);
+#endif // GEMINI_ICP1_PIN
+  if (!capturePin) {
+    GeminiHal::pinError(inputPin, GEMINI_STR(" is not the input capture pin!"));
+    return false;
   }
-
+  if (GeminiTimer::captureCallback != NULL &&
+      GeminiTimer::captureContext != this) {
+    GeminiHal::pinError(inputPin, GEMINI_STR(" is already used!"));
+    return false;
+  }
+  detach();
+  GEMINI_CRITICAL_SECTION() {
+    callback = newCallback;
+    context = newContext;
+    count = 0;
+    capture = true;
+  }
+  GeminiTimer::begin();
+  GeminiTimer::attachCapture(::captureInterrupt, this);
   return true;
 }
+#endif // GEMINI_USE_TIMER1
 
 /*!
-     @brief  wait for a positive edge on the input pin
-
-     @details this is a helper function that waits for a transition on the input
-   pin This function will block until a positive edge is detected on the input
-   pin. Only interrupt handlers are running while this function is waiting.
-
-     Note that this function will reset the edge detection, so the next update()
-   will not detect the same input edge. This is by design.
-
-     This function is not required at all to imnplement the gemini protocol, but
-   it can be useful in special circumstances. For example, at startup an
-   application may want to display an error message if the peer is not running.
+     @brief  detach the edge detector from the interrupt (if attached)
 */
-void GeminiProtocol::waitInputEdge() {
-  volatile bool wait = true;
-  while (wait) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-      if (inputEdgeDetected) {
-        wait = false;
-        inputEdgeDetected = false;
-      }
-    }
+void GeminiEdgeDetector::detach() {
+#ifdef GEMINI_USE_TIMER1
+  if (capture) {
+    GeminiTimer::detachCapture();
+    capture = false;
   }
-}
-
-/*!
-     @brief  wait for the input pin to be LOW
-
-     @details this is a helper function that waits for the input pin to be LOW
-     This function will block until the input pin is low or a timeout occurs.
-     Only interrupt handlers are running while this function is waiting.
-
-     This function is not required at all to imnplement the gemini protocol, but
-   it can be useful in special circumstances. For example, at startup an
-   application may want to detect a pulse lasting 100 microseconds or less on
-   the input pin. This can be achieved calling waitInputEdge() and
-   waitInputIdle(100) one after the other.
-   @param timeout_micros timeout in microseconds 
-   @return true if the input edge was detected, false in case of timeout
-*/
-bool GeminiProtocol::waitInputIdle(unsigned long timeout_micros) {
-  unsigned long currentTime = micros();
-  unsigned long waitStartTime = micros();
-  bool volatile inputPin = fast_read();
-  while (inputPin == true) {
-    currentTime = micros();
-    delayMicroseconds(4);
-    inputPin = fast_read();
-    if (currentTime - waitStartTime >= timeout_micros) {
-      return false;
-    }
+#endif // GEMINI_USE_TIMER1
+  if (interruptNumber == GEMINI_NO_INTERRUPT) {
+    return;
+  }
+  GeminiHal::detachEdge(interruptNumber);
+  GEMINI_CRITICAL_SECTION() {
+    edgeDetectors[interruptNumber] = NULL;
+    interruptNumber = GEMINI_NO_INTERRUPT;
   }
-  return true;
 }
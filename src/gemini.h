@@ -20,32 +20,187 @@
 #ifndef K197CTRL_GEMINI_H
 #define K197CTRL_GEMINI_H
 
-#include <Arduino.h>
-#include <util/atomic.h> // Include the atomic library
+#include "geminiHal.h"
+#include "geminiHistogram.h"
 
 #include "boolFifo.h"
+#include "geminiPins.h"
+#include "geminiTimer.h"
+#include "geminiTrace.h"
+#include "spscBoolFifo.h"
 
-// Note that using interrupts is required to catch the leading edge on the input
-// pin. On a UNO, only pin 2 or 3 will work as input pin!
+#ifdef GEMINI_USE_TIMER1
+#define GEMINI_ISR_FIFO_SIZE                                                   \
+  32 ///< size in bits of the FIFO between the interrupt handlers and update().
+     ///< A longer transfer is not split: the interrupt handler waits for
+     ///< update() to move the remaining bits (see outputBacklog)
+#endif // GEMINI_USE_TIMER1
 
-// comment the following definition if debug is not needed
-#define DEBUG_PORT PORTC ///< when defined, enable debug output to the port
+#define GEMINI_NO_INTERRUPT                                                    \
+  0xff ///< value of GeminiEdgeDetector::interruptNumber when not attached
 
-#ifdef DEBUG_PORT
 /*!
- * @brief macro used to output the state to DEBUG_PORT
+      @brief rising edge detector for the input pin of a gemini object
+
+      @details each GeminiProtocol object owns one edge detector. When
+   attached, the detector is stored in a static table indexed by the interrupt
+   number, and a dedicated interrupt handler (trampoline) for that interrupt
+   number calls interrupt() on the detector. This way several gemini objects
+   can be used at the same time, as long as they use different input pins.
+
+      interrupt() counts the edges and records the time of the last edge, so
+   that the object can detect if more than one edge was received since the
+   last time it looked (protocol error). If a callback is attached, the
+   callback is also called (used in interrupt driven mode).
+
+      When GEMINI_USE_TIMER1 is defined, the detector also records the Timer1
+   count at the time of the edge. The detector can also be attached to the
+   Timer1 input capture unit (attachCapture()) instead of an external
+   interrupt: in such a case the edge time is measured by the hardware, with
+   the resolution of Timer1 and no interrupt latency.
+*/
+class GeminiEdgeDetector {
+public:
+  /*!
+      @brief  edge handler, called in interrupt context
+      @param context the pointer passed when the callback was attached
+  */
+  typedef void (*Callback)(void *context);
+
+  bool attach(uint8_t inputPin, Callback newCallback = NULL,
+              void *newContext = NULL);
+#ifdef GEMINI_USE_TIMER1
+  bool attachCapture(uint8_t inputPin, Callback newCallback = NULL,
+                     void *newContext = NULL);
+#endif // GEMINI_USE_TIMER1
+  void detach();
+
+  /*!
+      @brief  handle a rising edge, called in interrupt context
+  */
+  inline void interrupt() {
+    lastEdgeTime = GeminiHal::micros();
+#ifdef GEMINI_USE_TIMER1
+    recordEdgeTicks(GeminiTimer::now());
+#endif // GEMINI_USE_TIMER1
+    edgeDetected();
+  };
+
+#ifdef GEMINI_USE_TIMER1
+  /*!
+      @brief  handle a rising edge captured by Timer1, called in interrupt
+     context
+      @param ticks the Timer1 count captured at the time of the edge
+  */
+  inline void captureInterrupt(uint16_t ticks) {
+    uint16_t elapsed = GeminiTimer::now() - ticks;
+    lastEdgeTime = GeminiHal::micros() - GeminiTimer::ticksToMicros(elapsed);
+    recordEdgeTicks(ticks);
+    edgeDetected();
+  };
+#endif // GEMINI_USE_TIMER1
+
+  /*!
+      @brief  get the number of edges detected since the last call and reset
+     the count
+      @details must be called with interrupts disabled (e.g. within a
+     GEMINI_CRITICAL_SECTION())
+      @return the number of edges detected (saturates at 255)
+  */
+  inline uint8_t take() {
+    uint8_t n = count;
+    count = 0;
+    return n;
+  };
+
+  volatile uint8_t count = 0; ///< edges detected, set in the interrupt handler
+  volatile unsigned long lastEdgeTime =
+      0; ///< value of micros() when the last edge was detected
+#ifdef GEMINI_USE_TIMER1
+  volatile uint16_t lastEdgeTicks =
+      0; ///< Timer1 count when the last edge was detected
+  volatile uint16_t lastIntervalTicks =
+      0; ///< Timer1 ticks between the last two edges
+#endif // GEMINI_USE_TIMER1
+
+private:
+  /*!
+      @brief  count the edge and call the callback (if any)
+  */
+  inline void edgeDetected() {
+    if (count != 0xff) {
+      count++;
+    }
+    if (callback != NULL) {
+      callback(context);
+    }
+  };
+#ifdef GEMINI_USE_TIMER1
+  /*!
+      @brief  record the Timer1 count of an edge
+      @param ticks the Timer1 count at the time of the edge
+  */
+  inline void recordEdgeTicks(uint16_t ticks) {
+    lastIntervalTicks = ticks - lastEdgeTicks;
+    lastEdgeTicks = ticks;
+  };
+  bool capture = false; ///< true when attached to the input capture unit
+#endif                  // GEMINI_USE_TIMER1
+
+  uint8_t interruptNumber =
+      GEMINI_NO_INTERRUPT; ///< the attached interrupt number
+  Callback callback = NULL; ///< edge handler (if any)
+  void *context = NULL;     ///< edge handler context
+};
+
+#define GEMINI_FRAME_TIMEOUT 50000UL ///< default frame timeout (microseconds)
+#define GEMINI_NO_DEADLINE_MICROS                                              \
+  1000000UL ///< nextDeadlineMicros() returns micros() + this value when only
+            ///< an input edge or new data can require update()
+
+// Note that using interrupts is required to catch the leading edge on the input
+// pin. On a UNO, only pin 2 or 3 will work as input pin! Two gemini objects can
+// be used at the same time with different input pins
+
+#ifdef GEMINI_TRACE_SIZE
+/*!
+ * @brief macro used to log a transition in the trace (see geminiTrace.h)
  */
-#define DEBUG_STATE()                                                          \
-  DEBUG_PORT = (DEBUG_PORT & 0xfc) | (((uint8_t)state) & 0x03)
+#define GEMINI_TRACE(event, oldState, newState, bits)                          \
+  this->traceEvent(GeminiTraceRecord::event, (uint8_t)(oldState),              \
+                   (uint8_t)(newState), (bits))
+#else
+#define GEMINI_TRACE(event, oldState, newState, bits)
+#endif // GEMINI_TRACE_SIZE
+
+#ifdef GEMINI_HISTOGRAMS
 /*!
- * @brief macro used to output frameEndDetected to DEBUG_PORT
+ * @brief macro used to count a time interval (see geminiHistogram.h)
  */
-#define DEBUG_FRAME_END()                                                       \
-  DEBUG_PORT = frameEndDetected ? (DEBUG_PORT & 0xfb) | 0x04 : DEBUG_PORT & 0xfb
+#define GEMINI_HISTOGRAM_ADD(histogram, us) this->histograms.histogram.add(us)
 #else
-#define DEBUG_STATE()
-#define DEBUG_FRAME_END()
-#endif // DEBUG_PORT
+#define GEMINI_HISTOGRAM_ADD(histogram, us)
+#endif // GEMINI_HISTOGRAMS
+
+/*!
+      @brief statistics collected by a GeminiProtocol object
+*/
+struct GeminiStats {
+  boolFifoStats input;  ///< input FIFO statistics
+  boolFifoStats output; ///< output FIFO statistics
+};
+
+/*!
+      @brief timing parameters of a GeminiProtocol object (microseconds)
+
+      @details see the constructor of GeminiProtocolT, setTiming() and
+   GeminiK197ControlT::startCalibration()
+*/
+struct GeminiTiming {
+  unsigned long writePulseMicros; ///< minimum duration of the write pulse
+  unsigned long readDelayMicros;  ///< edge to bit read
+  unsigned long writeDelayMicros; ///< acknowledge edge to output LOW
+};
 
 /*!
       @brief gemini protocol lower layer handler
@@ -64,22 +219,40 @@
    due to timout. however, the relevant members are protected, considering that
    the complete gemini frame specification should be implemented in a
    superclass.
+
+      The size of the input and output FIFO buffers are template parameters, so
+   they can be sized independently for each object (e.g. an application that
+   only receives data can use a very small output buffer). GeminiProtocol is
+   the same class with the default FIFO sizes.
+
+      When GEMINI_USE_TIMER1 is defined (see geminiTimer.h), the object can
+   also work in interrupt driven mode (see setInterruptDriven()).
+
+      The pin I/O is also a template parameter. The default (GeminiRuntimePins)
+   works with any pin. On a UNO, GeminiFixedPins resolves the pins at compile
+   time for faster and atomic I/O (see GeminiFixedProtocol).
+
+      @tparam INPUT_SIZE size of the input FIFO in bits (power of two)
+      @tparam OUTPUT_SIZE size of the output FIFO in bits (power of two)
+      @tparam PINS the pin I/O class (see geminiPins.h)
 */
-class GeminiProtocol {
+template <size_t INPUT_SIZE = INPUT_FIFO_SIZE,
+          size_t OUTPUT_SIZE = OUTPUT_FIFO_SIZE,
+          class PINS = GeminiRuntimePins>
+class GeminiProtocolT {
 public:
   /*!
       @brief  constructor for the class. After construction the FIFO is empty.
 
       @details See protocol specification for more information about the
-     protocol and its timing Note that handshakeTimeoutMicros is not implemented
-     yet
+     protocol and its timing
 
       @param inputPin input pin. Must be able to detect an edge interrupt (on a
      UNO, only pin 2 and 3 can be used)
       @param outputPin output pin. any I/O pin can be used
       @param writePulseMicros minimum duration of the write pulse
       @param handshakeTimeoutMicros timeout for handshakes. If no handshake
-     received the transmission is aborted
+     received the transmission is aborted (0 = no timeout)
       @param readDelayMicros delay from the time an edge is detected on the
      input pin, to the time the bit value is read
       @param writeDelayMicros minimum time when writing. After an edge is
@@ -87,26 +260,55 @@ public:
      the output pin), wait at least writeDelayMicros before returning the
      outpout pin to LOW
   */
-  GeminiProtocol(uint8_t inputPin, uint8_t outputPin,
-                 unsigned long writePulseMicros,
-                 unsigned long handshakeTimeoutMicros,
-                 unsigned long readDelayMicros, unsigned long writeDelayMicros)
-      : inputPin(inputPin), outputPin(outputPin),
+  GeminiProtocolT(uint8_t inputPin, uint8_t outputPin,
+                  unsigned long writePulseMicros,
+                  unsigned long handshakeTimeoutMicros,
+                  unsigned long readDelayMicros, unsigned long writeDelayMicros)
+      : inputPin(inputPin), outputPin(outputPin), pins(inputPin, outputPin),
         writePulseMicros(writePulseMicros),
         handshakeTimeoutMicros(handshakeTimeoutMicros),
-        readDelayMicros(readDelayMicros), writeDelayMicros(writeDelayMicros) {
-
-    inputBitmask = digitalPinToBitMask(inputPin);
-    outputBitmask = digitalPinToBitMask(outputPin);
-    uint8_t inputPort = digitalPinToPort(inputPin);
-    uint8_t outputPort = digitalPinToPort(outputPin);
-    inputRegister = portInputRegister(inputPort);
-    outputRegister = portOutputRegister(outputPort);
-  }
+        readDelayMicros(readDelayMicros), writeDelayMicros(writeDelayMicros) {}
+
+  /*!
+      @brief  constructor for the class, with pins defined at compile time
+
+      @details only available when the pins are template parameters (e.g.
+     GeminiFixedPins), the pins are taken from PINS. Same as the other
+     constructor for everything else.
+
+      @param writePulseMicros minimum duration of the write pulse
+      @param handshakeTimeoutMicros timeout for handshakes. If no handshake
+     received the transmission is aborted (0 = no timeout)
+      @param readDelayMicros delay from the time an edge is detected on the
+     input pin, to the time the bit value is read
+      @param writeDelayMicros minimum time when writing. After an edge is
+     detected on the input pin (signaling the other peer has read the value on
+     the output pin), wait at least writeDelayMicros before returning the
+     outpout pin to LOW
+  */
+  GeminiProtocolT(unsigned long writePulseMicros,
+                  unsigned long handshakeTimeoutMicros,
+                  unsigned long readDelayMicros, unsigned long writeDelayMicros)
+      : inputPin(PINS::fixedInputPin), outputPin(PINS::fixedOutputPin), pins(),
+        writePulseMicros(writePulseMicros),
+        handshakeTimeoutMicros(handshakeTimeoutMicros),
+        readDelayMicros(readDelayMicros), writeDelayMicros(writeDelayMicros) {}
 
   bool begin();
 
   void update();
+  bool needsService();
+  unsigned long nextDeadlineMicros();
+  /*!
+      @brief  check if the protocol is waiting for a deadline
+      @return true if update() must be called at a known time (see
+     nextDeadlineMicros()), false if only an edge on the input pin (or new
+     data to send) can change the state
+  */
+  bool hasDeadline() {
+    unsigned long deadline;
+    return getDeadline(deadline);
+  }
 
   /*!
       @brief  send 8 bits of data to the peer
@@ -126,17 +328,24 @@ public:
      beforre sending new data.
 
       @param data a single byte of data
-      @return true if all the 8 boits in data have been sent. False if one or
-     more bits could not be sent (output buffer full).
+      @return true if all the 8 bits in data have been pushed. False if there
+     is no room for 8 bits in the output buffer (no bit is pushed in such a
+     case).
  */
-  bool send(uint8_t data) {
-    for (int i = 7; i >= 0; i--) {
-      bool bitToSend = (data >> i) & 1;
-      if (!send(bitToSend)) {
-        return false; // Sending failed
-      }
-    }
-    return true; // All bits sent successfully
+  bool send(uint8_t data) { return outputBuffer.pushBits(data, 8); }
+
+  /*!
+      @brief  send up to 32 bits of data to the peer
+      @details this function pushes the nbits least significant bits of data
+     to the tail of the output buffer, MSB first, for subsequent transmission.
+     See send(uint8_t) for more information.
+      @param data the bits to send
+      @param nbits the number of bits to send (0 to 32)
+      @return true if all the bits have been pushed. False if there is no room
+     for nbits in the output buffer (no bit is pushed in such a case).
+ */
+  bool sendBits(uint32_t data, uint8_t nbits) {
+    return outputBuffer.pushBits(data, nbits);
   }
 
   /*!
@@ -160,13 +369,7 @@ public:
     @return true if the bit has been pushed. False if one or more bits could not
     be pushed (output buffer full).
    */
-  bool send(bool bit) {
-    if (outputBuffer.full()) {
-      return false; // Buffer is full
-    }
-    outputBuffer.push(bit);
-    return true;
-  }
+  bool send(bool bit) { return outputBuffer.push(bit); }
 
   /*!
     @brief  check if there is unread data in the input buffer
@@ -181,6 +384,11 @@ public:
     otherwise
    */
   bool hasData(uint8_t n) const { return inputBuffer.size() >= n; }
+  /*!
+    @brief  get the number of bits in the input buffer
+    @return the number of bits that can be received
+   */
+  size_t available() const { return inputBuffer.size(); }
 
   /*!
     @brief  receives one bit of data
@@ -212,15 +420,29 @@ public:
       }
     }
 
-    uint8_t receivedByte = 0;
-    for (int i = 7; i >= 0; i--) {
-      bool bitValue = inputBuffer.pull();
-      receivedByte |= (bitValue << i);
-    }
-
-    return receivedByte;
+    return (uint8_t)inputBuffer.pullBits(8);
   }
 
+  /*!
+    @brief  receive up to 32 bits of data
+    @details the first bit received is returned as bit nbits-1, the last as
+    bit 0. This function does not block, use hasData(nbits) before calling it.
+    @param nbits the number of bits to receive (0 to 32)
+    @return returns nbits of data, or 0 if less than nbits are available in
+    the input buffer (no bit is removed in such a case)
+   */
+  uint32_t receiveBits(uint8_t nbits) { return inputBuffer.pullBits(nbits); }
+
+  /*!
+    @brief  skip a sequence of 0 bits in the input buffer
+    @details all the bits set to 0 (LOW) at the head of the input buffer are
+    removed, up to the first bit set to 1 (HIGH), which is left in the input
+    buffer. This is much faster than calling receive() for each bit, e.g. to
+    skip a synchronization sequence.
+    @return the number of bits removed
+   */
+  size_t skipZeros() { return inputBuffer.skipZeros(); }
+
   /*!
     @brief  check free space in the output buffer
     @param nbits the number of bits to check
@@ -228,36 +450,192 @@ public:
     False otherwise
    */
   bool canSend(size_t nbits = 1) {
-    return nbits >= (OUTPUT_FIFO_SIZE - outputBuffer.size()) ? true : false;
+    return nbits <= (OUTPUT_SIZE - outputBuffer.size()) ? true : false;
   };
   /*!
     @brief  check if output pending
     @details output pending means that the output buffer still contains data
     @return true if output is pending, false otherwise
    */
-  bool isOutputPending() { return !outputBuffer.empty(); };
+  bool isOutputPending() { return !noOutputPending(); };
   /*!
     @brief  check if no output pending
     @details output pending means that the output buffer still contains data
     @return true if no output is pending, false otherwise
    */
-  bool noOutputPending() { return outputBuffer.empty(); };
+  bool noOutputPending() {
+#ifdef GEMINI_USE_TIMER1
+    if (!isrOutput.empty()) {
+      return false;
+    }
+#endif // GEMINI_USE_TIMER1
+    return outputBuffer.empty();
+  };
+
+  /*!
+    @brief  get the statistics collected since begin() or the last call to
+    resetStats()
+    @details the statistics include the maximum number of bits stored in the
+    input and output buffers (high water mark) as well as the number of bits
+    lost because a buffer was full (overflow) or requested when not available
+    (underflow). They can be used to size the buffers. Note that any input
+    overflow means that received data has been lost
+    @return the current statistics
+   */
+  GeminiStats getStats() const {
+    GeminiStats stats;
+    stats.input = inputBuffer.getStats();
+    stats.output = outputBuffer.getStats();
+#ifdef GEMINI_USE_TIMER1
+    GEMINI_CRITICAL_SECTION() {
+      stats.input.overflows += isrInputOverflows;
+    }
+#endif // GEMINI_USE_TIMER1
+    return stats;
+  };
+  /*!
+    @brief  reset the statistics
+    @details see getStats(). The timing histograms are also reset (see
+    getHistograms())
+   */
+  void resetStats() {
+    inputBuffer.resetStats();
+    outputBuffer.resetStats();
+#ifdef GEMINI_USE_TIMER1
+    GEMINI_CRITICAL_SECTION() { isrInputOverflows = 0; }
+#endif // GEMINI_USE_TIMER1
+#ifdef GEMINI_HISTOGRAMS
+    GEMINI_CRITICAL_SECTION() { histograms.reset(); }
+#endif // GEMINI_HISTOGRAMS
+  };
+
+#ifdef GEMINI_HISTOGRAMS
+  /*!
+    @brief  get the timing histograms collected since begin() or the last call
+    to resetStats()
+    @details only available when GEMINI_HISTOGRAMS is defined (see
+    geminiHistogram.h). The histograms show the read delay actually achieved
+    (to be compared with readDelayMicros), the time waiting for the
+    acknowledge, the gap between the bits of a frame and the frame duration
+    (frame layer only)
+    @return a copy of the histograms
+   */
+  GeminiHistograms getHistograms() const {
+    GeminiHistograms value;
+    GEMINI_CRITICAL_SECTION() { value = histograms; }
+    return value;
+  };
+#endif // GEMINI_HISTOGRAMS
+
+  /*!
+     @brief check if an acknowledge (handshake) timeout has been detected
+     @details an acknowledge timeout is detected when the peer does not
+     acknowledge a bit we sent within handshakeTimeoutMicros. The transmission
+     is aborted and the output buffer is flushed. This flag is reset when the
+     function resetHandshakeTimeoutCounter() is called
+     @return true if an acknowledge timeout was detected, false otherwise
+  */
+  bool handshakeTimeoutDetected() const {
+    return handshakeTimeoutCounter > 0 ? true : false;
+  };
+  /*!
+     @brief get the acknowledge (handshake) timeout counter
+     @details the counter is incremented any time an acknowledge timeout is
+     detected. The counter is reset when the function
+     resetHandshakeTimeoutCounter() is called
+     @return the value of the acknowledge timeout counter
+  */
+  unsigned long getHandshakeTimeoutCounter() const {
+    return handshakeTimeoutCounter;
+  };
+  /*!
+     @brief reset the acknowledge (handshake) timeout counter
+     @details For more information see handshakeTimeoutDetected() and
+     getHandshakeTimeoutCounter()
+  */
+  void resetHandshakeTimeoutCounter() { handshakeTimeoutCounter = 0L; };
+
+  /*!
+     @brief check if a protocol error has been detected
+     @details a protocol error is detected when more than one edge is received
+     on the input pin where only one is expected (e.g. a glitch on the input
+     pin, or update() not called often enough). The transfer is aborted like
+     for an acknowledge timeout, rather than merging the edges and corrupting
+     the data. This flag is reset when the function
+     resetProtocolErrorCounter() is called
+     @return true if a protocol error was detected, false otherwise
+  */
+  bool protocolErrorDetected() const {
+    return protocolErrorCounter > 0 ? true : false;
+  };
+  /*!
+     @brief get the protocol error counter
+     @details the counter is incremented any time a protocol error is
+     detected. The counter is reset when the function
+     resetProtocolErrorCounter() is called
+     @return the value of the protocol error counter
+  */
+  unsigned long getProtocolErrorCounter() const {
+    return protocolErrorCounter;
+  };
+  /*!
+     @brief reset the protocol error counter
+     @details For more information see protocolErrorDetected() and
+     getProtocolErrorCounter()
+  */
+  void resetProtocolErrorCounter() { protocolErrorCounter = 0L; };
 
   /*!
     @brief  generate an edge or pulse on the output pin
     @details the function set the output pin to HIGH, waits a number of
-    microseconds (using delayMicroseconds) and then set the pin to the requested
-    final state. It is used internally, but it is also available for special
-    uses (for example during startup)
+    microseconds (using GeminiHal::delayMicros) and then set the pin to the
+    requested final state. It is used internally, but it is also available for
+    special uses (for example during startup)
+
+    When GEMINI_USE_TIMER1 is defined, the function does not wait: it returns
+    as soon as the pin is set HIGH, and the Timer1 compare B interrupt sets the
+    final state (see GeminiTimer::startPulse()). Use waitPulseEnd() if the
+    caller must wait for the end of the pulse. The maximum duration is limited
+    by the Timer1 period (about 32 milliseconds at 16 MHz).
     @param microseconds the minimum duration of the edge or the duration of the
     pulse
     @param finalState if false a pulse is generated. If true a positive edge is
     generated
    */
   void pulse(unsigned long microseconds, bool finalState = false) {
+#ifdef GEMINI_USE_TIMER1
+    waitPulseEnd();
+    GeminiTimer::startPulse(pins.getOutputRegister(), pins.getOutputBitmask(),
+                            finalState,
+                            GeminiTimer::microsToTicks(microseconds));
+#else
     fast_write(true);
-    delayMicroseconds(microseconds);
+    GeminiHal::delayMicros(microseconds);
     fast_write(finalState);
+#endif // GEMINI_USE_TIMER1
+  }
+
+  /*!
+    @brief  check if a pulse is in progress on the output pin
+    @details always false unless GEMINI_USE_TIMER1 is defined (see pulse())
+    @return true if a pulse is in progress, false otherwise
+   */
+  bool isPulseActive() const {
+#ifdef GEMINI_USE_TIMER1
+    return GeminiTimer::pulseActive();
+#else
+    return false;
+#endif // GEMINI_USE_TIMER1
+  }
+
+  /*!
+    @brief  wait until the pulse in progress on the output pin (if any) ends
+    @details see pulse()
+   */
+  void waitPulseEnd() const {
+    while (isPulseActive()) {
+      // wait for the compare B interrupt
+    }
   }
 
   bool waitInputEdge(unsigned long timeout_micros);
@@ -279,37 +657,180 @@ public:
    */
 void setInitiatorMode(bool newMode) { canBeInitiator = newMode; };
 
+  /*!
+    @brief get the timing parameters
+    @return the write pulse, read delay and write delay in use
+   */
+  GeminiTiming getTiming() const {
+    GeminiTiming timing;
+    timing.writePulseMicros = writePulseMicros;
+    timing.readDelayMicros = readDelayMicros;
+    timing.writeDelayMicros = writeDelayMicros;
+    return timing;
+  };
+  /*!
+    @brief change the timing parameters
+    @details the parameters are normally set by the constructor. They can be
+    changed at any time (e.g. to restore a calibrated set saved in EEPROM, see
+    GeminiK197ControlT::startCalibration()), but a bit being transferred may
+    use either the old or the new values. To change them between frames, call
+    this function when both isFrameEndDetected() and noOutputPending() return
+    true.
+
+    The values are clamped to what can actually be generated: when
+    GEMINI_USE_TIMER1 is defined the write pulse is at least
+    GEMINI_TIMER_MIN_MICROS, and the write delay is never shorter than the
+    write pulse, so the pulse has ended when the output returns LOW. Use
+    getTiming() to get the values in use.
+    @param timing the new write pulse, read delay and write delay
+   */
+  void setTiming(const GeminiTiming &timing) {
+    unsigned long pulseMicros = timing.writePulseMicros;
+#ifdef GEMINI_USE_TIMER1
+    if (pulseMicros < GEMINI_TIMER_MIN_MICROS) { // see startPulse()
+      pulseMicros = GEMINI_TIMER_MIN_MICROS;
+    }
+#endif // GEMINI_USE_TIMER1
+    GEMINI_CRITICAL_SECTION() {
+      writePulseMicros = pulseMicros;
+      readDelayMicros = timing.readDelayMicros;
+      writeDelayMicros = timing.writeDelayMicros < pulseMicros
+                             ? pulseMicros
+                             : timing.writeDelayMicros;
+#ifdef GEMINI_USE_TIMER1
+      writePulseTicks = GeminiTimer::microsToTicks(writePulseMicros);
+      readDelayTicks = GeminiTimer::microsToTicks(readDelayMicros);
+      writeDelayTicks = GeminiTimer::microsToTicks(writeDelayMicros);
+#endif // GEMINI_USE_TIMER1
+    }
+  };
+
+#ifdef GEMINI_USE_TIMER1
+  /*!
+    @brief enable or disable the interrupt driven mode
+    @details in interrupt driven mode the protocol is the same, but the bits
+    are transferred by interrupt handlers: the rising edge interrupt arms a
+    Timer1 compare for the read (or write) delay, the compare interrupt samples
+    the input pin and drives the acknowledge or the next bit. update() only
+    moves the received bits to the input buffer, the bits to send from the
+    output buffer, and initiates a transmission when needed. This way the
+    timing does not depend on how often update() is called.
+
+    The interrupt handlers hold up to GEMINI_ISR_FIFO_SIZE bits to send. A
+    longer transfer (e.g. a K197 control frame) is never split: if the
+    interrupt handler runs out of bits while the output buffer still holds
+    some, the acknowledge of the last bit read is held until update() moves
+    the next bits. The peer just waits (within its handshake timeout).
+
+    Must be called before begin(). Only one object at a time can use the
+    interrupt driven mode.
+    @param enable enable interrupt driven mode when true, disable when false
+   */
+  void setInterruptDriven(bool enable) { interruptDriven = enable; };
+  /*!
+    @brief check if the interrupt driven mode is enabled
+    @return true if the interrupt driven mode is enabled, false otherwise
+   */
+  bool isInterruptDriven() const { return interruptDriven; };
+
+  /*!
+    @brief enable or disable the input capture edge source
+    @details when enabled, the rising edges on the input pin are detected and
+    timestamped by the Timer1 input capture unit, rather than by an external
+    interrupt. The input pin must be the ICP1 pin (GEMINI_ICP1_PIN, pin 8 on a
+    UNO). The exact time of the edge is then used to schedule the read at edge
+    + readDelayMicros (both in polled and interrupt driven mode), and it is
+    available to the application with getLastEdgeTicks() and
+    getLastBitTicks().
+
+    Must be called before begin(). Only one object at a time can use the input
+    capture edge source.
+    @param enable enable the input capture when true, disable when false
+   */
+  void setInputCapture(bool enable) { inputCapture = enable; };
+  /*!
+    @brief check if the input capture edge source is enabled
+    @return true if the input capture edge source is enabled, false otherwise
+   */
+  bool isInputCapture() const { return inputCapture; };
+
+  /*!
+    @brief get the time of the last rising edge on the input pin
+    @details the time is the value of the Timer1 counter (see GeminiTimer). With
+    the input capture edge source the time is measured by the hardware,
+    otherwise it is read in the interrupt handler
+    @return the Timer1 count at the time of the last edge
+   */
+  uint16_t getLastEdgeTicks() const {
+    uint16_t value = 0;
+    GEMINI_CRITICAL_SECTION() { value = inputEdge.lastEdgeTicks; }
+    return value;
+  };
+  /*!
+    @brief get the time between the last two rising edges on the input pin
+    @details this is the duration of the last bit exchanged with the peer, in
+    Timer1 ticks (use GeminiTimer::ticksToMicros() to convert to
+    microseconds). See also getLastEdgeTicks()
+    @return the Timer1 ticks between the last two edges
+   */
+  uint16_t getLastBitTicks() const {
+    uint16_t value = 0;
+    GEMINI_CRITICAL_SECTION() { value = inputEdge.lastIntervalTicks; }
+    return value;
+  };
+#endif // GEMINI_USE_TIMER1
+
+#ifdef GEMINI_TRACE_SIZE
+  /*!
+    @brief get the trace of the state transitions
+    @details only available when GEMINI_TRACE_SIZE is defined (see
+    geminiTrace.h). The application retrieves the records with
+    GeminiTraceT::pull() or prints them with GeminiTraceT::dump()
+    @return the trace of this object
+   */
+  GeminiTraceT<GEMINI_TRACE_SIZE> &getTrace() { return trace; };
+#endif // GEMINI_TRACE_SIZE
+
 private:
   /*!
     @brief  read the input pin using AVR registers directly
     @details the Arduino functions are too slow so using direct I/O is required
+    (see PINS)
     @return true if the input pin is high, false otherwise
    */
-  inline bool fast_read() {
-    return (*inputRegister & inputBitmask) != 0 ? true : false;
-  };
+  inline bool fast_read() { return pins.read(); };
   /*!
     @brief  write tpo the output pin using AVR registers directly
     @details the Arduino functions are too slow so using direct I/O is required
+    (see PINS)
     @param value if true the output pin is set to HIGH, otherwise LOW
    */
-  inline void fast_write(bool value) {
-    if (value) {
-      *outputRegister |= outputBitmask;
-    } else {
-      *outputRegister &= ~outputBitmask;
-    }
+  inline void fast_write(bool value) { pins.write(value); };
+  void abortTransfer(unsigned long currentTime);
+  bool getDeadline(unsigned long &deadline);
+  /*!
+    @brief  set the output pin HIGH for writePulseMicros, then to a new value
+    @details this is used to signal a new bit (or an acknowledge) to the peer.
+    When GEMINI_USE_TIMER1 is defined, the function does not wait for the end
+    of the pulse (see GeminiTimer::startPulse()), so it can be called in
+    interrupt context too
+    @param value the value of the output pin at the end of the pulse
+   */
+  inline void write_pulse(bool value) {
+#ifdef GEMINI_USE_TIMER1
+    GeminiTimer::startPulse(pins.getOutputRegister(), pins.getOutputBitmask(),
+                            value, writePulseTicks);
+#else
+    fast_write(HIGH);
+    GeminiHal::delayMicros(writePulseMicros);
+    fast_write(value);
+#endif // GEMINI_USE_TIMER1
   };
 
 private:
-  uint8_t inputPin;             ///< input pin
-  uint8_t outputPin;            ///< output pin
-  uint8_t inputBitmask = 0x00;  ///< bitmask used by fast_read()
-  uint8_t outputBitmask = 0x00; ///< bitmask used by fast_write()
-  volatile uint8_t *inputRegister =
-      NULL; ///< AVR register address used by fast_read()
-  volatile uint8_t *outputRegister =
-      NULL; ///< AVR register address used by fast_write()
+  uint8_t inputPin;  ///< input pin
+  uint8_t outputPin; ///< output pin
+  PINS pins;         ///< pin I/O used by fast_read() and fast_write()
 
   unsigned long writePulseMicros; ///< minimum duration of the write pulse
   unsigned long
@@ -339,18 +860,81 @@ private:
     BIT_WRITE_WAIT_ACK = 2, ///< waiting for a positive edge on the input pin
     BIT_WRITE_END = 3,      ///< waiting for writeDelayMicros after detecting a
                             ///< positive egde on the input pin
-  } state; ///< keep track of the protocol state machine 
+  };
+  volatile State state; ///< keep track of the protocol state machine
+  bool stateDeadline(State current, unsigned long lastTime,
+                     unsigned long &deadline);
 
-  boolFifo inputBuffer;  ///< the input buffer
-  boolFifo outputBuffer; ///< the output buffer
+  GeminiEdgeDetector inputEdge; ///< detect the rising edges on the input pin
+
+  unsigned long handshakeTimeoutCounter =
+      0; ///< count the acknowledge timeouts detected
+  unsigned long protocolErrorCounter = 0; ///< count the protocol errors
+
+  boolFifo<INPUT_SIZE> inputBuffer;   ///< the input buffer
+  boolFifo<OUTPUT_SIZE> outputBuffer; ///< the output buffer
+
+#ifdef GEMINI_USE_TIMER1
+  void updateInterruptDriven();
+  void edgeInterrupt();
+  void timerInterrupt();
+  /*!
+    @brief  edge interrupt callback (see GeminiEdgeDetector)
+    @param context pointer to the object
+   */
+  static void edgeCallback(void *context) {
+    ((GeminiProtocolT *)context)->edgeInterrupt();
+  };
+  /*!
+    @brief  timer interrupt trampoline (see GeminiTimer)
+    @param context pointer to the object
+   */
+  static void timerCallback(void *context) {
+    ((GeminiProtocolT *)context)->timerInterrupt();
+  };
+
+  bool interruptDriven = false; ///< true when in interrupt driven mode
+  bool inputCapture = false;    ///< true when using the input capture unit
+  uint16_t writePulseTicks;     ///< writePulseMicros in Timer1 ticks
+  uint16_t readDelayTicks;      ///< readDelayMicros in Timer1 ticks
+  uint16_t writeDelayTicks;     ///< writeDelayMicros in Timer1 ticks
+  spscBoolFifo<GEMINI_ISR_FIFO_SIZE>
+      isrInput; ///< bits received by the interrupt handler
+  spscBoolFifo<GEMINI_ISR_FIFO_SIZE>
+      isrOutput; ///< bits to be sent by the interrupt handler
+  unsigned long isrInputOverflows =
+      0; ///< bits lost because isrInput was full
+  volatile bool unexpectedEdge =
+      false; ///< set by edgeInterrupt() when an edge is not expected
+  volatile bool outputBacklog =
+      false; ///< set by update() while outputBuffer still holds bits of the
+             ///< transfer that did not fit in isrOutput
+  volatile bool outputStalled =
+      false; ///< set by timerInterrupt() when isrOutput is empty but
+             ///< outputBacklog is set: the bit read is not acknowledged until
+             ///< update() provides the next bit to send
+#endif   // GEMINI_USE_TIMER1
 
 protected:
-  unsigned long lastBitReadTime; ///< keep track of the time the last bit was
-                                 ///< read from the input pin
-  unsigned long frameTimeout = 50000L; ///< the frame timeout value
+  volatile unsigned long
+      lastBitReadTime; ///< keep track of the time the last bit was read from
+                       ///< the input pin
 
   /*!
-    @brief  set the frame timeout value (default at begin() is 5000 us
+    @brief  get the time the last bit was read from the input pin
+    @details lastBitReadTime is updated in interrupt context in interrupt
+    driven mode, so it must be read atomically
+    @return the value of micros() when the last bit was read
+   */
+  unsigned long getLastBitReadTime() const {
+    unsigned long value = 0;
+    GEMINI_CRITICAL_SECTION() { value = lastBitReadTime; }
+    return value;
+  };
+  unsigned long frameTimeout = GEMINI_FRAME_TIMEOUT; ///< the frame timeout
+
+  /*!
+    @brief  set the frame timeout value (default is GEMINI_FRAME_TIMEOUT)
     @details this is a protected function, to be used in the sub-class
     implementing the frame layer
     @param newValue the new timeout value to set
@@ -364,6 +948,8 @@ protected:
    */
   unsigned long getFrameTimeout() const { return frameTimeout; };
 
+  bool serviceDue(bool partialFrame);
+
   /*!
         @brief detect a frame end
         The frame end is detected if no data is received within the configured
@@ -379,6 +965,695 @@ protected:
   bool volatile frameEndDetected =
       true; ///< flag to keep track of frame timeouts detected at the lower
             ///< layer of the gemini protocol
+  bool transferAborted =
+      false; ///< set when a transfer is aborted due to an acknowledge timeout.
+             ///< Reset by the superclass implementing the frame layer
+
+#ifdef GEMINI_TRACE_SIZE
+  /*!
+    @brief  log a transition in the trace (see GEMINI_TRACE())
+    @details the levels of the input and output pins and frameEndDetected are
+    added to the bits. Can be called in interrupt context
+    @param event the event (see GeminiTraceRecord::Event)
+    @param oldState the state before the transition
+    @param newState the state after the transition
+    @param bits GEMINI_TRACE_BIT_READ and/or GEMINI_TRACE_BIT_WRITTEN
+   */
+  void traceEvent(uint8_t event, uint8_t oldState, uint8_t newState,
+                  uint8_t bits) {
+    if (pins.read()) {
+      bits |= GEMINI_TRACE_INPUT;
+    }
+    if (pins.readOutput()) {
+      bits |= GEMINI_TRACE_OUTPUT;
+    }
+    if (frameEndDetected) {
+      bits |= GEMINI_TRACE_FRAME_END;
+    }
+    trace.log(event, oldState, newState, bits);
+  };
+
+private:
+  GeminiTraceT<GEMINI_TRACE_SIZE> trace; ///< trace of the state transitions
+#endif // GEMINI_TRACE_SIZE
+
+#ifdef GEMINI_HISTOGRAMS
+protected:
+  GeminiHistograms histograms; ///< timing histograms (see getHistograms())
+#endif // GEMINI_HISTOGRAMS
 };
 
+/*!
+    @brief gemini protocol lower layer handler with the default FIFO sizes
+*/
+typedef GeminiProtocolT<> GeminiProtocol;
+
+#ifdef GEMINI_FIXED_PINS
+/*!
+      @brief GeminiProtocolT with the default FIFO sizes and pins defined at
+   compile time (see GeminiFixedPins)
+      @tparam INPUT_PIN the input pin
+      @tparam OUTPUT_PIN the output pin
+*/
+template <uint8_t INPUT_PIN, uint8_t OUTPUT_PIN>
+using GeminiFixedProtocol = GeminiProtocolT<INPUT_FIFO_SIZE, OUTPUT_FIFO_SIZE,
+                                            GeminiFixedPins<INPUT_PIN, OUTPUT_PIN> >;
+#endif // GEMINI_FIXED_PINS
+
+/*!
+     @brief  initialize the object.
+
+     @details It should be called before using the object
+
+     PREREQUISITES: Serial.begin must be called to see any error message
+     @return true if the call was succesful and the object can be used, false
+   otherwise
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE, class PINS>
+bool GeminiProtocolT<INPUT_SIZE, OUTPUT_SIZE, PINS>::begin() {
+#ifdef GEMINI_USE_TIMER1
+  bool checkInterrupt = !inputCapture;
+#else
+  bool checkInterrupt = true;
+#endif // GEMINI_USE_TIMER1
+  if (checkInterrupt && (GeminiHal::edgeInterrupt(inputPin) < 0)) {
+    GeminiHal::pinError(inputPin, GEMINI_STR(" does not support interrupts!"));
+    return false;
+  }
+  GeminiHal::pinInput(inputPin);
+  GeminiHal::pinOutput(outputPin, LOW);
+  state = State::IDLE;
+  lastBitReadTime = 0L;
+  resetStats();
+#ifdef GEMINI_USE_TIMER1
+  writePulseTicks = GeminiTimer::microsToTicks(writePulseMicros);
+  GeminiTimer::begin();
+  GeminiEdgeDetector::Callback callback = NULL;
+  if (interruptDriven) {
+    readDelayTicks = GeminiTimer::microsToTicks(readDelayMicros);
+    writeDelayTicks = GeminiTimer::microsToTicks(writeDelayMicros);
+    GeminiTimer::attachCompareA(timerCallback, this);
+    callback = edgeCallback;
+  }
+  if (inputCapture) {
+    return inputEdge.attachCapture(inputPin, callback, this);
+  }
+  return inputEdge.attach(inputPin, callback, this);
+#endif // GEMINI_USE_TIMER1
+  return inputEdge.attach(inputPin);
+}
+
+/*!
+     @brief  main input/output handler
+
+     @details in this function we update the internal state machine, reading and
+   writing data as required by the first layer of the gemini protocol
+   specification
+
+     The gemini protocol does not require a strict timing at eitehr side,
+   however update() should be called as often as possible (at least once every
+   loop() iteraction) to achieve maximum possible throughput and lowest possible
+   latency
+
+     If this function is not called for a significant amount of time, the
+   protocol may time-out and abort the current frame transmission
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE, class PINS>
+void GeminiProtocolT<INPUT_SIZE, OUTPUT_SIZE, PINS>::update() {
+#ifdef GEMINI_USE_TIMER1
+  if (interruptDriven) {
+    updateInterruptDriven();
+    return;
+  }
+#endif // GEMINI_USE_TIMER1
+  unsigned long currentTime = GeminiHal::micros();
+
+  uint8_t edges = 0;
+  switch (state) {
+  case State::IDLE:
+    GEMINI_CRITICAL_SECTION() {
+      edges = inputEdge.take();
+      if (edges == 1) {
+        isInitiator = false;
+#ifdef GEMINI_HISTOGRAMS
+        if (!frameEndDetected) {
+          histograms.bitGap.add(inputEdge.lastEdgeTime - lastBitReadTime);
+        }
+#endif // GEMINI_HISTOGRAMS
+        frameEndDetected = false;
+        state = State::BIT_READ_START;
+        lastBitReadTime = inputEdge.lastEdgeTime;
+        GEMINI_TRACE(STATE, State::IDLE, State::BIT_READ_START, 0);
+      } else if (edges > 1) { // edges merged, we do not know where we are
+        protocolErrorCounter++;
+        abortTransfer(currentTime);
+      }
+    }
+    if (edges != 0) {
+      break;
+    }
+    if (frameEndDetected) {
+      if (canBeInitiator && (outputBuffer.size() > 0)) {
+        isInitiator = true;
+        bool bitValue = outputBuffer.pull();
+        write_pulse(bitValue);
+        frameEndDetected = false;
+        state = State::BIT_WRITE_WAIT_ACK;
+        lastBitReadTime = currentTime;
+        GEMINI_TRACE(STATE, State::IDLE, State::BIT_WRITE_WAIT_ACK,
+                     bitValue ? GEMINI_TRACE_BIT_WRITTEN : 0);
+      }
+    } else if (currentTime - lastBitReadTime >= frameTimeout) {
+      frameEndDetected = true;
+      GEMINI_TRACE(FRAME_END, State::IDLE, State::IDLE, 0);
+    }
+    break;
+  case State::BIT_READ_START:
+    if (currentTime - lastBitReadTime >= readDelayMicros) {
+      bool bitValue = fast_read();
+      inputBuffer.push(bitValue);
+      GEMINI_HISTOGRAM_ADD(readDelay, currentTime - lastBitReadTime);
+
+      if (outputBuffer.empty()) {
+        if (isInitiator) { // we need to stop here
+          GEMINI_CRITICAL_SECTION() {
+            fast_write(LOW);     // Just to be sure...
+            isInitiator = false; // just to be sure...
+            state = State::IDLE;
+          }
+        } else { // must send an acknowledge
+          write_pulse(false);
+          state = State::IDLE;
+        }
+        GEMINI_TRACE(STATE, State::BIT_READ_START, State::IDLE,
+                     bitValue ? GEMINI_TRACE_BIT_READ : 0);
+      } else { // if we have data to send, we cannot stop until we have sent it
+               // all...
+        bool nextBit = outputBuffer.pull();
+        write_pulse(nextBit);
+        state = State::BIT_WRITE_WAIT_ACK;
+        GEMINI_TRACE(STATE, State::BIT_READ_START, State::BIT_WRITE_WAIT_ACK,
+                     (bitValue ? GEMINI_TRACE_BIT_READ : 0) |
+                         (nextBit ? GEMINI_TRACE_BIT_WRITTEN : 0));
+      }
+      lastBitReadTime = currentTime;
+    }
+    break;
+
+  case State::BIT_WRITE_WAIT_ACK:
+    GEMINI_CRITICAL_SECTION() {
+      edges = inputEdge.take();
+      if (edges == 1) {
+        state = State::BIT_WRITE_END;
+        GEMINI_HISTOGRAM_ADD(ackWait, inputEdge.lastEdgeTime - lastBitReadTime);
+        lastBitReadTime = inputEdge.lastEdgeTime;
+        GEMINI_TRACE(STATE, State::BIT_WRITE_WAIT_ACK, State::BIT_WRITE_END, 0);
+      } else if (edges > 1) { // edges merged, we do not know where we are
+        protocolErrorCounter++;
+        abortTransfer(currentTime);
+      } else if ((handshakeTimeoutMicros != 0) &&
+                 (currentTime - lastBitReadTime >= handshakeTimeoutMicros)) {
+        handshakeTimeoutCounter++;
+        abortTransfer(currentTime);
+      }
+    }
+    break;
+
+  case State::BIT_WRITE_END:
+    if (currentTime - lastBitReadTime >= writeDelayMicros) {
+#ifdef GEMINI_USE_TIMER1
+      // the end of a pulse still in progress would drive the pin again
+      GEMINI_CRITICAL_SECTION() { GeminiTimer::cancelPulse(); }
+#endif // GEMINI_USE_TIMER1
+      fast_write(false);
+      state = State::BIT_READ_START;
+      lastBitReadTime = currentTime;
+      GEMINI_TRACE(STATE, State::BIT_WRITE_END, State::BIT_READ_START, 0);
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+/*!
+     @brief  check if update() must be called now
+
+     @details update() must be called when an edge has been detected on the
+   input pin, when a transmission can be initiated, or when the deadline
+   returned by nextDeadlineMicros() has expired. Otherwise calling update()
+   does not change anything, so an application (or a cooperative scheduler)
+   can use the CPU for something else until the deadline.
+
+     In interrupt driven mode, update() must also be called when bits must be
+   moved between the FIFO buffers and the interrupt handlers.
+     @return true if update() must be called now, false otherwise
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE, class PINS>
+bool GeminiProtocolT<INPUT_SIZE, OUTPUT_SIZE, PINS>::needsService() {
+  return serviceDue(false);
+}
+
+/*!
+     @brief  protected function, check if update() must be called now
+
+     @details same as needsService(), with an optional frame timeout for the
+   frame layer. In interrupt driven mode the state, lastBitReadTime and the
+   pending transfers are read in a single critical section; in polled mode no
+   critical section is needed, since only update() changes them. micros() is
+   only read once, when there is a deadline, so that the check costs less
+   than the update() it saves
+     @param partialFrame if true, update() must also be called at the frame
+   timeout after the last bit read (a partial frame in the frame layer)
+     @return true if update() must be called now, false otherwise
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE, class PINS>
+bool GeminiProtocolT<INPUT_SIZE, OUTPUT_SIZE, PINS>::serviceDue(
+    bool partialFrame) {
+  bool pending = false;
+  bool output = !outputBuffer.empty();
+  State current = State::IDLE;
+  unsigned long lastTime = 0;
+#ifdef GEMINI_USE_TIMER1
+  if (interruptDriven) {
+    GEMINI_CRITICAL_SECTION() {
+      current = state;
+      lastTime = lastBitReadTime;
+      pending = unexpectedEdge || outputStalled || !isrInput.empty() ||
+                (output && !isrOutput.full());
+      output = output || !isrOutput.empty();
+    }
+  } else
+#endif // GEMINI_USE_TIMER1
+  {
+    // polled mode: state and lastBitReadTime are only changed by update(),
+    // the edge count is a single byte
+    current = state;
+    lastTime = lastBitReadTime;
+    pending = inputEdge.count != 0;
+  }
+  if (pending) {
+    return true;
+  }
+  if ((current == State::IDLE) && frameEndDetected && canBeInitiator &&
+      output) {
+    return true;
+  }
+  unsigned long deadline = 0;
+  bool hasDeadline = stateDeadline(current, lastTime, deadline);
+  if (partialFrame) {
+    unsigned long timeout = lastTime + frameTimeout;
+    if (!hasDeadline || ((long)(timeout - deadline) < 0)) {
+      deadline = timeout;
+      hasDeadline = true;
+    }
+  }
+  return hasDeadline && ((long)(GeminiHal::micros() - deadline) >= 0);
+}
+
+/*!
+     @brief  get the time when update() must be called, if no edge is detected
+     in the meantime
+
+     @details each state of the protocol waits for an edge on the input pin or
+   for a delay: readDelayMicros and writeDelayMicros while a bit is
+   transferred, the acknowledge timeout while waiting for the peer, the frame
+   timeout after the last bit. In interrupt driven mode the read and write
+   delays are handled by the interrupt handlers.
+
+     When the protocol is waiting for an edge only, micros() +
+   GEMINI_NO_DEADLINE_MICROS is returned. See also needsService()
+     @return the value of micros() when update() must be called
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE, class PINS>
+unsigned long
+GeminiProtocolT<INPUT_SIZE, OUTPUT_SIZE, PINS>::nextDeadlineMicros() {
+  unsigned long deadline;
+  return getDeadline(deadline) ? deadline
+                               : GeminiHal::micros() + GEMINI_NO_DEADLINE_MICROS;
+}
+
+/*!
+     @brief  private function, get the deadline of the current state
+     @details used by nextDeadlineMicros() and hasDeadline(), it is not
+   intended for any other use
+     @param deadline set to the value of micros() when update() must be
+   called, when the function returns true
+     @return true if the current state has a deadline, false otherwise
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE, class PINS>
+bool GeminiProtocolT<INPUT_SIZE, OUTPUT_SIZE, PINS>::getDeadline(
+    unsigned long &deadline) {
+  State current = State::IDLE;
+  unsigned long lastTime = 0;
+  GEMINI_CRITICAL_SECTION() {
+    current = state;
+    lastTime = lastBitReadTime;
+  }
+  return stateDeadline(current, lastTime, deadline);
+}
+
+/*!
+     @brief  private function, get the deadline of a state
+     @details used by getDeadline() and serviceDue(), it is not intended for
+   any other use
+     @param current the state
+     @param lastTime the value of lastBitReadTime in that state
+     @param deadline set to the value of micros() when update() must be
+   called, when the function returns true
+     @return true if the state has a deadline, false otherwise
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE, class PINS>
+bool GeminiProtocolT<INPUT_SIZE, OUTPUT_SIZE, PINS>::stateDeadline(
+    State current, unsigned long lastTime, unsigned long &deadline) {
+  bool polled = true;
+#ifdef GEMINI_USE_TIMER1
+  polled = !interruptDriven;
+#endif // GEMINI_USE_TIMER1
+  switch (current) {
+  case State::IDLE:
+    if (!frameEndDetected) {
+      deadline = lastTime + frameTimeout;
+      return true;
+    }
+    break;
+  case State::BIT_READ_START:
+    if (polled) {
+      deadline = lastTime + readDelayMicros;
+      return true;
+    }
+    break;
+  case State::BIT_WRITE_WAIT_ACK:
+    if (handshakeTimeoutMicros != 0) {
+      deadline = lastTime + handshakeTimeoutMicros;
+      return true;
+    }
+    break;
+  case State::BIT_WRITE_END:
+    if (polled) {
+      deadline = lastTime + writeDelayMicros;
+      return true;
+    }
+    break;
+  }
+  return false;
+}
+
+#ifdef GEMINI_USE_TIMER1
+/*!
+     @brief  main input/output handler in interrupt driven mode
+
+     @details the bits are transferred by the interrupt handlers, here we only
+   move the received bits to the input buffer and the bits to send to the
+   interrupt handler. We also detect the frame end and initiate a transmission
+   when required.
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE, class PINS>
+void GeminiProtocolT<INPUT_SIZE, OUTPUT_SIZE, PINS>::updateInterruptDriven() {
+  while (!isrInput.empty()) {
+    if (!inputBuffer.push(isrInput.pull())) {
+      break; // inputBuffer counts the overflow, the bit is lost
+    }
+  }
+  while (!outputBuffer.empty() && !isrOutput.full()) {
+    isrOutput.push(outputBuffer.pull());
+  }
+  outputBacklog = !outputBuffer.empty(); // after the bits have been pushed
+
+  unsigned long currentTime = GeminiHal::micros();
+  GEMINI_CRITICAL_SECTION() {
+    if (unexpectedEdge) {
+      protocolErrorCounter++;
+      abortTransfer(currentTime);
+    } else if ((state == State::BIT_WRITE_WAIT_ACK) &&
+               (handshakeTimeoutMicros != 0) &&
+               (currentTime - lastBitReadTime >= handshakeTimeoutMicros)) {
+      handshakeTimeoutCounter++;
+      abortTransfer(currentTime);
+    } else if (outputStalled && !isrOutput.empty()) {
+      // the peer is still waiting for the acknowledge of the last bit read:
+      // resume the transfer with the next bit (the interrupt handlers cannot
+      // run, so it is safe to pull from update())
+      outputStalled = false;
+      bool nextBit = isrOutput.pull();
+      write_pulse(nextBit);
+      state = State::BIT_WRITE_WAIT_ACK;
+      lastBitReadTime = currentTime;
+      GEMINI_TRACE(STATE, State::BIT_READ_START, State::BIT_WRITE_WAIT_ACK,
+                   nextBit ? GEMINI_TRACE_BIT_WRITTEN : 0);
+    } else if (state == State::IDLE) {
+      if (frameEndDetected) {
+        if (canBeInitiator && !isrOutput.empty()) {
+          // isrOutput is normally pulled by the interrupt handlers, but here
+          // they cannot run, so it is safe to pull from update()
+          isInitiator = true;
+          bool bitValue = isrOutput.pull();
+          write_pulse(bitValue);
+          frameEndDetected = false;
+          state = State::BIT_WRITE_WAIT_ACK;
+          lastBitReadTime = currentTime;
+          GEMINI_TRACE(STATE, State::IDLE, State::BIT_WRITE_WAIT_ACK,
+                       bitValue ? GEMINI_TRACE_BIT_WRITTEN : 0);
+        }
+      } else if (currentTime - lastBitReadTime >= frameTimeout) {
+        frameEndDetected = true;
+        GEMINI_TRACE(FRAME_END, State::IDLE, State::IDLE, 0);
+      }
+    }
+  }
+}
+
+/*!
+     @brief  rising edge handler in interrupt driven mode
+
+     @details called in interrupt context when a rising edge is detected on the
+   input pin. Arms the Timer1 compare for the read delay (new bit) or the write
+   delay (acknowledge of the bit we are sending). An edge received in any other
+   state means that the previous edge has not been handled yet: it is reported
+   to updateInterruptDriven() as a protocol error.
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE, class PINS>
+void GeminiProtocolT<INPUT_SIZE, OUTPUT_SIZE, PINS>::edgeInterrupt() {
+  uint16_t now = inputEdge.lastEdgeTicks;
+  if (unexpectedEdge) {
+    return; // wait until update() aborts the transfer
+  }
+  switch (state) {
+  case State::IDLE:
+    isInitiator = false;
+#ifdef GEMINI_HISTOGRAMS
+    if (!frameEndDetected) {
+      histograms.bitGap.add(inputEdge.lastEdgeTime - lastBitReadTime);
+    }
+#endif // GEMINI_HISTOGRAMS
+    frameEndDetected = false;
+    state = State::BIT_READ_START;
+    GeminiTimer::scheduleCompareA(now, readDelayTicks);
+    GEMINI_TRACE(STATE, State::IDLE, State::BIT_READ_START, 0);
+    break;
+  case State::BIT_WRITE_WAIT_ACK:
+    state = State::BIT_WRITE_END;
+    GeminiTimer::scheduleCompareA(now, writeDelayTicks);
+    GEMINI_HISTOGRAM_ADD(ackWait, inputEdge.lastEdgeTime - lastBitReadTime);
+    GEMINI_TRACE(STATE, State::BIT_WRITE_WAIT_ACK, State::BIT_WRITE_END, 0);
+    break;
+  default:
+    unexpectedEdge = true;
+    return;
+  }
+  lastBitReadTime = inputEdge.lastEdgeTime;
+}
+
+/*!
+     @brief  timer handler in interrupt driven mode
+
+     @details called in interrupt context when the read or write delay armed by
+   edgeInterrupt() expires. Samples the input pin and drives the acknowledge or
+   the next bit, or returns the output pin to LOW at the end of a write.
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE, class PINS>
+void GeminiProtocolT<INPUT_SIZE, OUTPUT_SIZE, PINS>::timerInterrupt() {
+  unsigned long currentTime = GeminiHal::micros();
+  switch (state) {
+  case State::BIT_READ_START: {
+    bool bitValue = fast_read();
+    if (!isrInput.push(bitValue)) {
+      isrInputOverflows++;
+    }
+    GEMINI_HISTOGRAM_ADD(readDelay, currentTime - lastBitReadTime);
+    if (isrOutput.empty() && outputBacklog) {
+      // the transfer is not complete: hold the acknowledge (the peer waits)
+      // until update() moves the next bits to isrOutput
+      outputStalled = true;
+      break;
+    }
+    if (isrOutput.empty()) {
+      if (isInitiator) { // we need to stop here
+        fast_write(LOW);
+        isInitiator = false;
+      } else { // must send an acknowledge
+        write_pulse(false);
+      }
+      state = State::IDLE;
+      GEMINI_TRACE(STATE, State::BIT_READ_START, State::IDLE,
+                   bitValue ? GEMINI_TRACE_BIT_READ : 0);
+    } else { // if we have data to send, we cannot stop until we have sent it
+             // all...
+      bool nextBit = isrOutput.pull();
+      write_pulse(nextBit);
+      state = State::BIT_WRITE_WAIT_ACK;
+      GEMINI_TRACE(STATE, State::BIT_READ_START, State::BIT_WRITE_WAIT_ACK,
+                   (bitValue ? GEMINI_TRACE_BIT_READ : 0) |
+                       (nextBit ? GEMINI_TRACE_BIT_WRITTEN : 0));
+    }
+    break;
+  }
+  case State::BIT_WRITE_END:
+    GeminiTimer::cancelPulse(); // the pulse end would drive the pin again
+    fast_write(false);
+    state = State::BIT_READ_START;
+    GeminiTimer::scheduleCompareA(GeminiTimer::now(), readDelayTicks);
+    GEMINI_TRACE(STATE, State::BIT_WRITE_END, State::BIT_READ_START, 0);
+    break;
+  default:
+    return;
+  }
+  lastBitReadTime = currentTime;
+}
+#endif // GEMINI_USE_TIMER1
+
+/*!
+     @brief  abort the current transfer after an acknowledge timeout or a
+   protocol error
+
+     @details the output pin is set LOW, the state machine returns to IDLE and
+   all the data in the output buffer is discarded. transferAborted is set, so
+   that the frame layer can skip the rest of the frame. A new transmission
+   cannot be initiated before a frame timeout. Must be called with interrupts
+   disabled.
+     @param currentTime the current time in microseconds
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE, class PINS>
+void GeminiProtocolT<INPUT_SIZE, OUTPUT_SIZE, PINS>::abortTransfer(
+    unsigned long currentTime) {
+#ifdef GEMINI_USE_TIMER1
+  if (interruptDriven) {
+    GeminiTimer::cancelCompareA();
+    isrOutput.flush(); // safe, the interrupt handlers cannot run
+    unexpectedEdge = false;
+    outputBacklog = false;
+    outputStalled = false;
+  }
+  GeminiTimer::cancelPulse();
+#endif // GEMINI_USE_TIMER1
+  fast_write(LOW);
+  outputBuffer.flush();
+  inputEdge.take(); // discard any edge already detected
+  isInitiator = false;
+  GEMINI_TRACE(ABORT, state, State::IDLE, 0);
+  state = State::IDLE;
+  lastBitReadTime = currentTime;
+  transferAborted = true;
+}
+
+/*!
+     @brief  wait for a positive edge on the input pin
+
+     @details this is a helper function that waits for a transition on the input
+   pin This function will block until a positive edge is detected on the input
+   pin or a timeout occurs. Only interrupt handlers are running while this
+   function is waiting.
+
+     Note that this function will reset the edge detection, so the next update()
+   will not detect the same input edge. This is by design.
+
+     This function is not required at all to imnplement the gemini protocol, but
+   it can be useful in special circumstances. For example, at startup an
+   application may want to display an error message if the peer is not running.
+
+     @param timeout_micros timeout in microseconds
+     @return true if an edge was detected, false if the function returns due to
+   timeout
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE, class PINS>
+bool GeminiProtocolT<INPUT_SIZE, OUTPUT_SIZE, PINS>::waitInputEdge(
+    unsigned long timeout_micros) {
+  unsigned long currentTime = GeminiHal::micros();
+  unsigned long waitStartTime = currentTime;
+  volatile bool wait = true;
+  while (wait) {
+    currentTime = GeminiHal::micros();
+    GeminiHal::delayMicros(4);
+    GEMINI_CRITICAL_SECTION() {
+      if (inputEdge.take() != 0) {
+        wait = false;
+      }
+    }
+    if (currentTime - waitStartTime >= timeout_micros) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/*!
+     @brief  wait for a positive edge on the input pin
+
+     @details this is a helper function that waits for a transition on the input
+   pin This function will block until a positive edge is detected on the input
+   pin. Only interrupt handlers are running while this function is waiting.
+
+     Note that this function will reset the edge detection, so the next update()
+   will not detect the same input edge. This is by design.
+
+     This function is not required at all to imnplement the gemini protocol, but
+   it can be useful in special circumstances. For example, at startup an
+   application may want to display an error message if the peer is not running.
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE, class PINS>
+void GeminiProtocolT<INPUT_SIZE, OUTPUT_SIZE, PINS>::waitInputEdge() {
+  volatile bool wait = true;
+  while (wait) {
+    GEMINI_CRITICAL_SECTION() {
+      if (inputEdge.take() != 0) {
+        wait = false;
+      }
+    }
+  }
+}
+
+/*!
+     @brief  wait for the input pin to be LOW
+
+     @details this is a helper function that waits for the input pin to be LOW
+     This function will block until the input pin is low or a timeout occurs.
+     Only interrupt handlers are running while this function is waiting.
+
+     This function is not required at all to imnplement the gemini protocol, but
+   it can be useful in special circumstances. For example, at startup an
+   application may want to detect a pulse lasting 100 microseconds or less on
+   the input pin. This can be achieved calling waitInputEdge() and
+   waitInputIdle(100) one after the other.
+   @param timeout_micros timeout in microseconds 
+   @return true if the input edge was detected, false in case of timeout
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE, class PINS>
+bool GeminiProtocolT<INPUT_SIZE, OUTPUT_SIZE, PINS>::waitInputIdle(
+    unsigned long timeout_micros) {
+  unsigned long currentTime = GeminiHal::micros();
+  unsigned long waitStartTime = GeminiHal::micros();
+  bool volatile inputPin = fast_read();
+  while (inputPin == true) {
+    currentTime = GeminiHal::micros();
+    GeminiHal::delayMicros(4);
+    inputPin = fast_read();
+    if (currentTime - waitStartTime >= timeout_micros) {
+      return false;
+    }
+  }
+  return true;
+}
+
 #endif // K197CTRL_GEMINI_H
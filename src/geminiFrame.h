@@ -21,36 +21,10 @@
 #define K197CTRL_GEMINI_FRAME_H
 #include "gemini.h"
 
-#ifdef DEBUG_PORT
-/*!
- * @brief macro used to output frameState to DEBUG_PORT
- */
-#define DEBUG_FRAME_STATE()                                                    \
-  DEBUG_PORT = (DEBUG_PORT & 0xe7) | ((((uint8_t)frameState) << 3) & 0x18)
-#else
-#define DEBUG_FRAME_STATE()
-#endif // DEBUG_PORT
-
-//#define DEBUG_GEMINI_FRAME  // comment/uncomment to activate debug prints
-#ifdef DEBUG_GEMINI_FRAME
-/*!
- * @brief debug output macro
- */
-#define DEBUG_PRINT(...) Serial.print(__VA_ARGS__)
-/*!
- * @brief debug output macro
- */
-#define DEBUG_PRINTLN(...) Serial.println(__VA_ARGS__)
-#else
-/*!
- * @brief debug output macro
- */
-#define DEBUG_PRINT(...) 
-/*!
- * @brief debug output macro
- */
-#define DEBUG_PRINTLN(...)
-#endif // DEBUG_GEMINI_FRAME
+#define GEMINI_SYNC_ZEROS                                                      \
+  9 ///< minimum number of 0 bits in a sequence marking a frame start
+#define GEMINI_SYNC_FRAME_TIMEOUT                                              \
+  5000UL ///< default frame timeout (microseconds) in frame sync mode
 
 /*!
       @brief gemini frame layer handler
@@ -67,26 +41,62 @@
    return true. Data must be read with getFrame() before a new frame can be
    received (alternatively resetFrame() can be called).
 
+      Alternatively, two arrays can be passed at begin() (ping-pong mode). A
+   complete frame is then obtained with acquireFrame() and returned with
+   releaseFrame(), while the next frame is received in the other array. If
+   the application has not acquired and released the previous frame when the
+   next one starts, the newer frame is dropped (see getFrameDroppedCounter()).
+
       When no array is passed at begin(), the function can only be used to
    receive data.
 
+      If the peer does not acknowledge a bit within the handshake timeout, the
+   lower layer aborts the transfer and the rest of the frame (in both
+   directions) is skipped (see GeminiProtocolT::handshakeTimeoutDetected()).
+
+      By default the start of a frame is detected when the lower layer
+   detects the end of the previous frame (frame timeout). In frame sync mode
+   (see setFrameSync()) a sequence of GEMINI_SYNC_ZEROS or more 0 bits also
+   marks the start of a new frame, and a much shorter frame timeout can be
+   used.
+
       The method sendFrame()is used to send a uint8_t array in a gemini frame.
+
+      GeminiFrame is the same class with the default FIFO sizes.
+
+      @tparam INPUT_SIZE size of the input FIFO in bits (power of two)
+      @tparam OUTPUT_SIZE size of the output FIFO in bits (power of two)
+      @tparam PINS the pin I/O class (see GeminiProtocolT)
 */
-class GeminiFrame : public GeminiProtocol {
+template <size_t INPUT_SIZE = INPUT_FIFO_SIZE,
+          size_t OUTPUT_SIZE = OUTPUT_FIFO_SIZE,
+          class PINS = GeminiRuntimePins>
+class GeminiFrameT : public GeminiProtocolT<INPUT_SIZE, OUTPUT_SIZE, PINS> {
+  typedef GeminiProtocolT<INPUT_SIZE, OUTPUT_SIZE, PINS>
+      GeminiProtocol; ///< the lower layer (base class)
+
 public:
+  using GeminiProtocol::available;
+  using GeminiProtocol::hasData;
+  using GeminiProtocol::receive;
+  using GeminiProtocol::receiveByte;
+  using GeminiProtocol::receiveBits;
+  using GeminiProtocol::send;
+  using GeminiProtocol::sendBits;
+  using GeminiProtocol::skipZeros;
+
   /*!
       @brief  constructor for the class. After construction the FIFO is empty.
 
       @details See protocol specification for more information about the
-     protocol and its timing Note that handshakeTimeoutMicros is not implemented
-     yet
+     protocol and its timing
 
       @param inputPin input pin. Must be able to detect an edge interrupt (on a
      UNO, only pin 2 and 3 can be used)
       @param outputPin output pin. any I/O pin can be used
       @param writePulseMicros minimum duration of the write pulse
       @param handshakeTimeoutMicros timeout for handshakes. If no handshake
-     received the transmission is aborted
+     received the transmission is aborted (0 = no timeout)
       @param readDelayMicros delay from the time an edge is detected on the
      input pin, to the time the bit value is read
       @param writeDelayMicros minimum time when writing. After an edge is
@@ -94,16 +104,40 @@ public:
      the output pin), wait at least writeDelayMicros before returning the
      outpout pin to LOW
   */
-  GeminiFrame(uint8_t inputPin, uint8_t outputPin,
-              unsigned long writePulseMicros,
-              unsigned long handshakeTimeoutMicros,
-              unsigned long readDelayMicros, unsigned long writeDelayMicros)
+  GeminiFrameT(uint8_t inputPin, uint8_t outputPin,
+               unsigned long writePulseMicros,
+               unsigned long handshakeTimeoutMicros,
+               unsigned long readDelayMicros, unsigned long writeDelayMicros)
       : GeminiProtocol(inputPin, outputPin, writePulseMicros,
                        handshakeTimeoutMicros, readDelayMicros,
                        writeDelayMicros) {
     frameState = FrameState::WAIT_FRAME_START;
   }
 
+  /*!
+      @brief  constructor for the class, with pins defined at compile time
+
+      @details only available when the pins are template parameters (e.g.
+     GeminiFixedPins), see GeminiProtocolT.
+
+      @param writePulseMicros minimum duration of the write pulse
+      @param handshakeTimeoutMicros timeout for handshakes. If no handshake
+     received the transmission is aborted (0 = no timeout)
+      @param readDelayMicros delay from the time an edge is detected on the
+     input pin, to the time the bit value is read
+      @param writeDelayMicros minimum time when writing. After an edge is
+     detected on the input pin (signaling the other peer has read the value on
+     the output pin), wait at least writeDelayMicros before returning the
+     outpout pin to LOW
+  */
+  GeminiFrameT(unsigned long writePulseMicros,
+               unsigned long handshakeTimeoutMicros,
+               unsigned long readDelayMicros, unsigned long writeDelayMicros)
+      : GeminiProtocol(writePulseMicros, handshakeTimeoutMicros,
+                       readDelayMicros, writeDelayMicros) {
+    frameState = FrameState::WAIT_FRAME_START;
+  }
+
   /*!
    @brief  initialize the object.
 
@@ -126,14 +160,10 @@ public:
       return false;
     pInputData = NULL;
     pInputData_len = 0;
+    pFrontData = NULL;
+    frontReady = false;
+    frontHeld = false;
     frameState = FrameState::WAIT_FRAME_START;
-#ifdef DEBUG_PORT        // Make sure the following pins match the definition of
-                         // DEBUG_PORT above!
-    pinMode(A3, OUTPUT); // TODO: use direct port manipulation so the above is
-                         // always verified...
-    pinMode(A4, OUTPUT);
-    DEBUG_FRAME_STATE();
-#endif // DEBUG_PORT
     return true;
   }
 
@@ -166,6 +196,38 @@ public:
     return true;
   }
 
+  /*!
+       @brief  initialize the object with two frame buffers (ping-pong mode).
+
+       @details It should be called before using the object
+       Same as begin(pdata, nbytes), but two buffers of the same size are used
+     alternatively. While the application processes a complete frame, obtained
+     with acquireFrame(), the next frame is received into the other buffer.
+     When the latter is complete, it is handed over to the application
+     swapping the two buffers (no data is copied).
+
+       In ping-pong mode, the application should use acquireFrame() and
+     releaseFrame() instead of frameComplete() and getFrame().
+
+       PREREQUISITES: Serial.begin must be called to see any error message
+
+       @param bufA point to the first buffer where to store frame data
+       @param bufB point to the second buffer where to store frame data
+       @param nbytes number of data in a frame (size of each buffer)
+       @return true if the call was succesful and the object can be used, false
+     otherwise
+  */
+  bool begin(uint8_t *bufA, uint8_t *bufB, uint8_t nbytes) {
+    if ((bufB == NULL) || (bufB == bufA)) {
+      return false;
+    }
+    if (!begin(bufA, nbytes)) {
+      return false;
+    }
+    pFrontData = bufB;
+    return true;
+  }
+
   /*!
        @brief  send a sequence of bytes as a frame to the lower layer
        @details this function send a sequence of bytes as a frame
@@ -182,8 +244,7 @@ public:
   */
   void sendFrame(uint8_t *pdata, uint8_t nbytes) {
     for (uint8_t i = 0; i < nbytes; i++) {
-      send(true);
-      send(pdata[i]);
+      sendBits(0x100 | pdata[i], 9); // start bit + 8 data bits
     }
   }
 
@@ -203,6 +264,12 @@ public:
   */
   void update() {
     GeminiProtocol::update();
+    if (transferAborted) { // acknowledge timeout, skip the rest of the frame
+      transferAborted = false;
+      discardFrame();
+      GEMINI_TRACE(FRAME_STATE, frameState, FrameState::FRAME_END, 0);
+      frameState = FrameState::FRAME_END;
+    }
     switch (frameState) {
     case FrameState::WAIT_FRAME_START:
       // pInputData == NULL means ignore input data
@@ -211,11 +278,18 @@ public:
           receive();
       }
       if (!frameEndDetected) {
-        resetFrame();
+        // in frame sync mode, a partial frame is discarded at the next sync
+        if (!frameSync || frameComplete()) {
+          discardFrame();
+        }
+#ifdef GEMINI_HISTOGRAMS
+        if (byte_counter == 0) {
+          frameStartTime = getLastBitReadTime(); // time of the first edge
+        }
+#endif // GEMINI_HISTOGRAMS
         frameState = FrameState::WAIT_FRAME_DATA;
-        DEBUG_FRAME_STATE();
-        DEBUG_PRINTLN();
-        DEBUG_PRINT('[');
+        GEMINI_TRACE(FRAME_STATE, FrameState::WAIT_FRAME_START,
+                     FrameState::WAIT_FRAME_DATA, 0);
       }
       break;
 
@@ -225,8 +299,8 @@ public:
       }
       if (frameEndDetected) {
         frameState = FrameState::FRAME_END;
-        DEBUG_FRAME_STATE();
-        DEBUG_PRINT(']');
+        GEMINI_TRACE(FRAME_STATE, FrameState::WAIT_FRAME_DATA,
+                     FrameState::FRAME_END, 0);
       }
       break;
 
@@ -236,63 +310,188 @@ public:
         receive();
       if (frameEndDetected) {
         frameState = FrameState::WAIT_FRAME_START;
-        DEBUG_FRAME_STATE();
-        DEBUG_PRINT('*');
-        DEBUG_PRINTLN();
+        GEMINI_TRACE(FRAME_STATE, FrameState::FRAME_END,
+                     FrameState::WAIT_FRAME_START, 0);
       }
       break;
     }
+    if (handOverReady()) { // ping-pong mode: hand over the complete frame
+      uint8_t *pdata = pFrontData;
+      pFrontData = pInputData;
+      pInputData = pdata;
+      frontReady = true;
+      resetFrame();
+    }
+    processedBits = available();
+  }
+
+  /*!
+     @brief  check if update() must be called now
+
+     @details in addition to the lower layer (see
+     GeminiProtocolT::needsService()), update() must be called when new data
+     has been received, when the frame state must change after a frame end or
+     a frame start, and at the frame timeout
+     @return true if update() must be called now, false otherwise
+  */
+  bool needsService() {
+    if (transferAborted) {
+      return true;
+    }
+    if ((pInputData != NULL) && (available() != processedBits)) {
+      return true;
+    }
+    bool frameEnd = frameEndDetected;
+    switch (frameState) {
+    case FrameState::WAIT_FRAME_START:
+      if (!frameEnd) {
+        return true;
+      }
+      break;
+    case FrameState::WAIT_FRAME_DATA:
+    case FrameState::FRAME_END:
+      if (frameEnd) {
+        return true;
+      }
+      break;
+    }
+    if (handOverReady()) {
+      return true;
+    }
+    return GeminiProtocol::serviceDue(
+        (frameState == FrameState::WAIT_FRAME_DATA) && !frameSync &&
+        frameStarted());
+  }
+
+  /*!
+     @brief  get the time when update() must be called, if no edge is detected
+     in the meantime
+     @details see GeminiProtocolT::nextDeadlineMicros(). When frame sync mode
+     is disabled, the frame timeout of a partial frame is also considered
+     @return the value of micros() when update() must be called
+  */
+  unsigned long nextDeadlineMicros() {
+    unsigned long deadline = GeminiProtocol::nextDeadlineMicros();
+    if ((frameState == FrameState::WAIT_FRAME_DATA) && !frameSync &&
+        frameStarted()) {
+      unsigned long timeout = getLastBitReadTime() + frameTimeout;
+      if ((long)(timeout - deadline) < 0) {
+        deadline = timeout;
+      }
+    }
+    return deadline;
+  }
+
+  /*!
+     @brief  check if the frame layer is waiting for a deadline
+     @details see GeminiProtocolT::hasDeadline(). When frame sync mode is
+     disabled, the frame timeout of a partial frame is also a deadline
+     @return true if update() must be called at a known time
+  */
+  bool hasDeadline() {
+    return GeminiProtocol::hasDeadline() ||
+           ((frameState == FrameState::WAIT_FRAME_DATA) && !frameSync &&
+            frameStarted());
   }
 
 private:
   /*!
      @brief  private function, handles data while a frame is being received
-     @details this function is called by GeminiFrame(), it is not intended for
+     @details this function is called by update(), it is not intended for
      any other use
   */
   void handleFrameData() {
     if (frameComplete()) {
       while (hasData()) {
-#ifdef DEBUG_GEMINI_FRAME
-        bool receivedBit = receive();
-        DEBUG_PRINT('-');
-        DEBUG_PRINT(receivedBit ? '1' : '0');
-#else
-        receive();
-#endif // DEBUG_GEMINI_FRAME
+        // a start bit after the last sub-frame: the frame is longer than
+        // expected, or the zeros have been read as ones
+        if (receive() && !frameOverflow) {
+          frameOverflow = true;
+          frameOverflowCounter++;
+        }
       }
       return;
     }
-    if (hasData()) { // fill the frame
-      if (start_bit) {
-        if (hasData(8)) {
-          pInputData[byte_counter] = receiveByte(false);
-          DEBUG_PRINT(' ');
-          DEBUG_PRINT(pInputData[byte_counter], BIN);
-          byte_counter++;
-          start_bit = false;
-          if (frameComplete()) {
-            DEBUG_PRINT('>');
+    if (hasData()) { // fill the frame with all the sub-frames available
+      while (!frameComplete()) {
+        if (!start_bit) {
+          // jump over any synchronization bit, straight to the start bit
+          size_t zeros = skipZeros();
+          zeros += zeroRun;
+          zeroRun = zeros >= GEMINI_SYNC_ZEROS ? GEMINI_SYNC_ZEROS : zeros;
+          if (!hasData()) {
+            break;
           }
+          if (frameSync && (zeroRun >= GEMINI_SYNC_ZEROS)) {
+            if (byte_counter > 0) { // partial frame
+              frameResyncCounter++;
+              GEMINI_TRACE(FRAME_RESYNC, frameState, frameState, 0);
+              resetFrame();
+#ifdef GEMINI_HISTOGRAMS
+              frameStartTime = getLastBitReadTime();
+#endif // GEMINI_HISTOGRAMS
+            }
+          }
+          zeroRun = 0; // a start bit follows
+          if (hasData(9)) { // a complete sub-frame, start bit is bit 8
+            storeByte((uint8_t)receiveBits(9));
+            continue;
+          }
+          start_bit = receive(); // always true after skipZeros()
         }
-        // eventually we will have 8 bits or frameEndDetected in update()
-      } else {
-        start_bit = receive();
-        if (start_bit) {
-          DEBUG_PRINT(F(" 1<"));
-        } else {
-          DEBUG_PRINT(0);
+        if (!hasData(8)) {
+          break; // eventually we will have 8 bits or frameEndDetected
         }
+        storeByte(receiveByte(false));
       }
-    } else if (frameStarted()) {
+    } else if (frameStarted() && !frameSync) {
       if (checkFrameTimeout()) {
         frameTimeoutCounter++;
-        DEBUG_PRINT('T');
+        GEMINI_TRACE(FRAME_TIMEOUT, frameState, frameState, 0);
         resetFrame();
       }
     }
   }
 
+  /*!
+     @brief  private function, checks if a complete frame can be handed over
+     to the application (ping-pong mode)
+     @return true if the buffers can be swapped
+  */
+  bool handOverReady() const {
+    return (pFrontData != NULL) && frameComplete() && !frontReady &&
+           !frontHeld;
+  }
+
+  /*!
+     @brief  private function, resets the frame being received
+     @details in ping-pong mode a complete frame can only be here if it could
+     not be handed over (see handOverReady()), so it is counted as dropped
+  */
+  void discardFrame() {
+    if ((pFrontData != NULL) && frameComplete()) {
+      frameDroppedCounter++;
+    }
+    resetFrame();
+  }
+
+  /*!
+     @brief  private function, stores a byte received in the frame buffer
+     @details this function is called by handleFrameData(), it is not intended
+     for any other use
+     @param data the data byte received
+  */
+  void storeByte(uint8_t data) {
+    pInputData[byte_counter] = data;
+    byte_counter++;
+    start_bit = false;
+#ifdef GEMINI_HISTOGRAMS
+    if (frameComplete()) {
+      this->histograms.frameDuration.add(GeminiHal::micros() - frameStartTime);
+    }
+#endif // GEMINI_HISTOGRAMS
+  }
+
 public:
   /*!
      @brief check if a complete frame is available
@@ -316,7 +515,7 @@ public:
   void resetFrame() {
     byte_counter = 0;
     start_bit = false;
-    DEBUG_PRINT('#');
+    frameOverflow = false;
   }
 
   /*!
@@ -351,10 +550,34 @@ public:
      @return pointer to the current input buffer
   */
   uint8_t *getFrame() {
-    DEBUG_PRINT('@');
     resetFrame();
     return pInputData;
   };
+  /*!
+     @brief get a complete frame (ping-pong mode)
+     @details in ping-pong mode (see begin(uint8_t *, uint8_t *, uint8_t)),
+     this function returns the last complete frame received. The buffer is
+     owned by the application until releaseFrame() is called: update() will
+     not modify it, while a new frame is received in the other buffer. It is
+     not possible to acquire a new frame until the current one is released.
+     @return pointer to the buffer with the frame, NULL if no new frame is
+     available (or not in ping-pong mode)
+  */
+  uint8_t *acquireFrame() {
+    if (!frontReady) {
+      return NULL;
+    }
+    frontReady = false;
+    frontHeld = true;
+    return pFrontData;
+  };
+  /*!
+     @brief release a frame obtained with acquireFrame() (ping-pong mode)
+     @details after this function is called, the buffer returned by
+     acquireFrame() can be used to receive a new frame
+  */
+  void releaseFrame() { frontHeld = false; };
+
   /*!
      @brief get the current input frame buffer size
      @return the size (number of bytes) of the current input frame buffer
@@ -386,6 +609,118 @@ public:
   */
   void resetFrameTimeoutCounter() { frameTimeoutCounter = 0L; };
 
+  /*!
+     @brief enable or disable frame sync mode
+     @details in frame sync mode, a sequence of GEMINI_SYNC_ZEROS or more 0
+     bits received while waiting for a start bit marks the start of a new
+     frame. Any partial frame is then discarded and counted (see
+     getFrameResyncCounter()). The K197 always sends 16 0 bits before a
+     measurement, while a run of more than 8 0 bits cannot be found inside a
+     sequence of sub-frames.
+
+     Since the frame start does not depend on the frame timeout any more, a
+     partial frame is not discarded at the lower layer frame timeout, and a
+     much shorter frame timeout can be used. The lower layer still uses the
+     frame timeout to detect the end of a transmission (e.g. before it can
+     initiate a new one).
+     @param enable true to enable frame sync mode, false to disable it
+     @param newFrameTimeout the new frame timeout in microseconds. If 0
+     (default) GEMINI_SYNC_FRAME_TIMEOUT is used when enabling frame sync mode,
+     GEMINI_FRAME_TIMEOUT when disabling it
+  */
+  void setFrameSync(bool enable, unsigned long newFrameTimeout = 0) {
+    frameSync = enable;
+    if (newFrameTimeout == 0) {
+      newFrameTimeout = enable ? GEMINI_SYNC_FRAME_TIMEOUT : GEMINI_FRAME_TIMEOUT;
+    }
+    GeminiProtocol::setFrameTimeout(newFrameTimeout);
+  };
+  /*!
+     @brief check if frame sync mode is enabled
+     @return true if frame sync mode is enabled, false otherwise
+  */
+  bool getFrameSync() const { return frameSync; };
+
+  /*!
+     @brief check if a partial frame has been discarded in frame sync mode
+     @details this flag is reset when the function resetFrameResyncCounter()
+     is called
+     @return true if a partial frame was discarded, false otherwise
+  */
+  bool frameResyncDetected() const {
+    return frameResyncCounter > 0 ? true : false;
+  };
+  /*!
+     @brief get the frame resync counter
+     @details the frame resync counter is incremented any time a partial frame
+     is discarded because a new frame start is detected in frame sync mode. The
+     counter is reset when the function resetFrameResyncCounter() is called
+     @return the value of the frame resync counter
+  */
+  unsigned long getFrameResyncCounter() const { return frameResyncCounter; };
+  /*!
+     @brief reset the frame resync counter
+     @details For more information see frameResyncDetected() and
+     getFrameResyncCounter()
+  */
+  void resetFrameResyncCounter() { frameResyncCounter = 0L; };
+
+  /*!
+     @brief check if data has been received after a complete frame
+     @details this flag is reset when the function resetFrameOverflowCounter()
+     is called
+     @return true if a frame overflow was detected, false otherwise
+  */
+  bool frameOverflowDetected() const {
+    return frameOverflowCounter > 0 ? true : false;
+  };
+  /*!
+     @brief get the frame overflow counter
+     @details the frame overflow counter is incremented when a start bit is
+     received after a complete frame, before the frame end. The extra data is
+     discarded. With the K197 this means that some bits have been read
+     incorrectly (e.g. the read delay is too short), so that the frame
+     received is corrupted. The counter is reset when the function
+     resetFrameOverflowCounter() is called
+     @return the value of the frame overflow counter
+  */
+  unsigned long getFrameOverflowCounter() const {
+    return frameOverflowCounter;
+  };
+  /*!
+     @brief reset the frame overflow counter
+     @details For more information see frameOverflowDetected() and
+     getFrameOverflowCounter()
+  */
+  void resetFrameOverflowCounter() { frameOverflowCounter = 0L; };
+
+  /*!
+     @brief check if a complete frame has been dropped (ping-pong mode)
+     @details this flag is reset when the function resetFrameDroppedCounter()
+     is called
+     @return true if a frame was dropped, false otherwise
+  */
+  bool frameDroppedDetected() const {
+    return frameDroppedCounter > 0 ? true : false;
+  };
+  /*!
+     @brief get the frame dropped counter
+     @details in ping-pong mode, a complete frame can only be handed over when
+     the previous one has been acquired and released (see acquireFrame()). If
+     the next frame starts before that, the newer frame (the one not yet
+     handed over) is discarded and the counter is incremented, while the older
+     frame is kept for the application. The counter is reset when the
+     function resetFrameDroppedCounter() is called
+     @return the value of the frame dropped counter
+  */
+  unsigned long getFrameDroppedCounter() const { return frameDroppedCounter; };
+  /*!
+     @brief reset the frame dropped counter
+     @details For more information see frameDroppedDetected() and
+     getFrameDroppedCounter()
+  */
+  void resetFrameDroppedCounter() { frameDroppedCounter = 0L; };
+
 protected:
   /*!
       @brief set the input frame buffer
@@ -413,8 +748,10 @@ private:
       @return true if a frame timeout is detected, false otherwise
   */
   bool checkFrameTimeout() {
-    return micros() - lastBitReadTime >= frameTimeout ? true : false;
+    return GeminiHal::micros() - getLastBitReadTime() >= frameTimeout ? true
+                                                                      : false;
   };
+protected:
   /*!
       @brief check if a frame reception has started
       @details this function is used internally to check if a frame has started
@@ -424,15 +761,35 @@ private:
     return (byte_counter > 0 || start_bit == true) ? true : false;
   };
 
+private:
+
   uint8_t *pInputData = NULL; ///< pointer to the input frame buffer
+  uint8_t *pFrontData =
+      NULL; ///< ping-pong mode: pointer to the frame buffer handed over to
+            ///< the application (NULL when not in ping-pong mode)
+  bool frontReady = false; ///< ping-pong mode: pFrontData has a new frame
+  bool frontHeld = false;  ///< ping-pong mode: pFrontData acquired
   uint8_t pInputData_len;     ///< array lenght of the input frame buffer
   uint8_t byte_counter =
       0; ///< while a frame is received, keeps track of the current byte
   bool start_bit = false; ///< set when a start bit is received, reset after the
                           ///< last bit of a byte has been received
+  size_t processedBits = 0; ///< bits left in the input buffer by update()
 
   unsigned long frameTimeoutCounter = 0; ///< frame timeout counter
 
+  bool frameSync = false; ///< true when frame sync mode is enabled
+  uint8_t zeroRun = 0; ///< number of consecutive 0 bits (saturates at
+                       ///< GEMINI_SYNC_ZEROS) while waiting for a start bit
+  unsigned long frameResyncCounter = 0; ///< frame resync counter
+  bool frameOverflow = false; ///< data received after the frame was complete
+  unsigned long frameOverflowCounter = 0; ///< frame overflow counter
+  unsigned long frameDroppedCounter = 0;  ///< frame dropped counter
+#ifdef GEMINI_HISTOGRAMS
+  unsigned long frameStartTime =
+      0; ///< time of the first bit of the frame (see GeminiHistograms)
+#endif // GEMINI_HISTOGRAMS
+
   /*!
       @brief state machine for the gemini frame layer
   */
@@ -444,10 +801,31 @@ private:
 
 protected:
   using GeminiProtocol::begin;
+  using GeminiProtocol::frameEndDetected;
+  using GeminiProtocol::frameTimeout;
+  using GeminiProtocol::getLastBitReadTime;
+  using GeminiProtocol::transferAborted;
 
 public:
   // in the current implementation, we re-use the protected base class function making it public
   using GeminiProtocol::isFrameEndDetected; 
 };
 
+/*!
+    @brief gemini frame layer handler with the default FIFO sizes
+*/
+typedef GeminiFrameT<> GeminiFrame;
+
+#ifdef GEMINI_FIXED_PINS
+/*!
+      @brief GeminiFrameT with the default FIFO sizes and pins defined at
+   compile time (see GeminiFixedPins)
+      @tparam INPUT_PIN the input pin
+      @tparam OUTPUT_PIN the output pin
+*/
+template <uint8_t INPUT_PIN, uint8_t OUTPUT_PIN>
+using GeminiFixedFrame = GeminiFrameT<INPUT_FIFO_SIZE, OUTPUT_FIFO_SIZE,
+                                      GeminiFixedPins<INPUT_PIN, OUTPUT_PIN> >;
+#endif // GEMINI_FIXED_PINS
+
 #endif // K197CTRL_GEMINI_FRAME_H
@@ -0,0 +1,288 @@
+/**************************************************************************/
+/*!
+  @file     geminiHal.h
+
+  Arduino K197Control library
+
+  Copyright (C) 2023 by ALX2009
+
+  License: MIT (see LICENSE)
+
+  This file is part of the Arduino K197Display sketch, please see
+  https://github.com/alx2009/K197Control for more information
+
+  This file defines the GeminiHal class
+  The GeminiHal class is the hardware abstraction layer used by the gemini
+  protocol: clock, pin I/O, edge interrupts and critical sections. The AVR
+  (Arduino) implementation is used when ARDUINO is defined, otherwise a host
+  implementation is used, so that the library can be compiled and tested on
+  a PC (see geminiHalHost.cpp)
+
+*/
+/**************************************************************************/
+#ifndef K197CTRL_GEMINI_HAL_H
+#define K197CTRL_GEMINI_HAL_H
+
+#ifdef ARDUINO
+
+#include <Arduino.h>
+#include <avr/sleep.h>
+#include <util/atomic.h> // Include the atomic library
+
+/*!
+ * @brief start a block of code executed with interrupts disabled
+ */
+#define GEMINI_CRITICAL_SECTION() ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+
+/*!
+ * @brief store a string constant in flash (when supported)
+ */
+#define GEMINI_STR(s) F(s)
+
+#ifndef GEMINI_EDGE_INTERRUPTS
+// The core only defines EXTERNAL_NUM_INTERRUPTS in wiring_private.h, which is
+// not part of its public interface: the number of external interrupts
+// reachable with attachInterrupt() is defined here for each MCU. Other MCUs
+// can define GEMINI_EDGE_INTERRUPTS before including the library.
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) ||               \
+    defined(__AVR_ATmega168__) || defined(__AVR_ATmega168P__) ||               \
+    defined(__AVR_ATmega8__)
+#define GEMINI_EDGE_INTERRUPTS 2 ///< number of external interrupts
+#elif defined(__AVR_ATmega32U4__)
+#define GEMINI_EDGE_INTERRUPTS 5 ///< number of external interrupts
+#elif defined(__AVR_ATmega2560__) || defined(__AVR_ATmega1280__)
+#define GEMINI_EDGE_INTERRUPTS 6 ///< number of external interrupts
+#elif defined(__AVR_ATmega1284P__) || defined(__AVR_ATmega1284__) ||           \
+    defined(__AVR_ATmega644P__) || defined(__AVR_ATmega644__)
+#define GEMINI_EDGE_INTERRUPTS 3 ///< number of external interrupts
+#else
+#error "Unknown MCU, please define GEMINI_EDGE_INTERRUPTS"
+#endif
+#endif // GEMINI_EDGE_INTERRUPTS
+
+/*!
+      @brief hardware abstraction layer for the gemini protocol (Arduino)
+
+      @details all the functions are inline wrappers for the Arduino core
+*/
+class GeminiHal {
+public:
+  typedef const __FlashStringHelper
+      *Message; ///< type of the strings defined with GEMINI_STR()
+  typedef void (*EdgeHandler)(); ///< edge interrupt handler
+
+  /*!
+      @brief  get the current time
+      @return the number of microseconds since startup (same as micros())
+  */
+  static inline unsigned long micros() { return ::micros(); };
+  /*!
+      @brief  wait a number of microseconds (busy wait)
+      @param us the number of microseconds to wait
+  */
+  static inline void delayMicros(unsigned long us) {
+    delayMicroseconds((unsigned int)us);
+  };
+  /*!
+      @brief  wait a number of milliseconds
+      @param ms the number of milliseconds to wait
+  */
+  static inline void delayMillis(unsigned long ms) { delay(ms); };
+
+  /*!
+      @brief  configure a pin as input
+      @param pin the pin number
+  */
+  static inline void pinInput(uint8_t pin) { pinMode(pin, INPUT); };
+  /*!
+      @brief  configure a pin as output, setting its initial value
+      @param pin the pin number
+      @param value the initial value
+  */
+  static inline void pinOutput(uint8_t pin, bool value) {
+    digitalWrite(pin, value ? HIGH : LOW);
+    pinMode(pin, OUTPUT);
+    digitalWrite(pin, value ? HIGH : LOW);
+  };
+
+  /*!
+      @brief  get the interrupt number for a pin
+      @param pin the pin number
+      @return the interrupt number, or -1 if the pin cannot detect edges
+  */
+  static inline int edgeInterrupt(uint8_t pin) {
+    int irq = digitalPinToInterrupt(pin);
+    return (irq == NOT_AN_INTERRUPT || irq >= GEMINI_EDGE_INTERRUPTS) ? -1
+                                                                       : irq;
+  };
+  /*!
+      @brief  attach a handler to the rising edge of an interrupt
+      @param irq the interrupt number
+      @param handler the interrupt handler
+  */
+  static inline void attachRisingEdge(uint8_t irq, EdgeHandler handler) {
+    attachInterrupt(irq, handler, RISING);
+  };
+  /*!
+      @brief  detach the handler of an interrupt
+      @param irq the interrupt number
+  */
+  static inline void detachEdge(uint8_t irq) { detachInterrupt(irq); };
+
+  /*!
+      @brief  disable interrupts (see sleepIdle())
+  */
+  static inline void disableInterrupts() { noInterrupts(); };
+  /*!
+      @brief  enable interrupts
+  */
+  static inline void enableInterrupts() { interrupts(); };
+  /*!
+      @brief  sleep until the next interrupt
+      @details must be called with interrupts disabled, so that the sleep
+     condition can be checked without missing an edge: interrupts are enabled
+     by the instruction just before sleeping, and no interrupt can be served
+     in between. Returns with interrupts enabled.
+
+     The IDLE sleep mode is used: the external interrupts can only wake the
+     MCU on an edge when the I/O clock is running, and the timers keep
+     running so that micros() is still valid. Note that the Timer0 overflow
+     interrupt (used by millis()) wakes the MCU every 1024 us.
+  */
+  static inline void sleepIdle() {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_enable();
+    interrupts();
+    sleep_cpu();
+    sleep_disable();
+  };
+
+  /*!
+      @brief  print an error message
+      @param msg the message (defined with GEMINI_STR())
+  */
+  static inline void error(Message msg) { Serial.println(msg); };
+  /*!
+      @brief  print an error message about a pin: "Error: Pin <pin><msg>"
+      @param pin the pin number
+      @param msg the message (defined with GEMINI_STR())
+  */
+  static inline void pinError(uint8_t pin, Message msg) {
+    Serial.print(F("Error: Pin "));
+    Serial.print(pin);
+    Serial.println(msg);
+  };
+};
+
+#else // host implementation
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*!
+ * @brief start a block of code executed with interrupts disabled
+ */
+#define GEMINI_CRITICAL_SECTION()                                              \
+  for (GeminiHal::CriticalSection geminiCriticalSection_;                      \
+       geminiCriticalSection_.once();)
+
+/*!
+ * @brief store a string constant in flash (when supported)
+ */
+#define GEMINI_STR(s) (s)
+
+#define GEMINI_EDGE_INTERRUPTS 8 ///< number of edge interrupts (pins 0 to 7)
+#define GEMINI_HOST_PINS 32      ///< number of simulated pins
+
+#ifndef HIGH
+#define HIGH 1 ///< same as Arduino
+#define LOW 0  ///< same as Arduino
+#endif
+
+/*!
+      @brief hardware abstraction layer for the gemini protocol (host)
+
+      @details the pins are simulated in memory. Pins 0 to 7 can detect edges,
+   and the interrupt number is the same as the pin number. An interrupt is
+   simulated by calling raiseEdge(): the handler is called immediately, or at
+   the end of the current critical section.
+
+      By default the clock is the monotonic clock of the host, and the delays
+   are busy waits. A simulation can replace the clock and the delays with
+   setClock(), can be notified of any output pin change with setPinHook(),
+   and can decide how long sleepIdle() sleeps with setSleepHook(). See
+   geminiHalHost.cpp.
+*/
+class GeminiHal {
+public:
+  typedef const char *Message;   ///< type of the strings (GEMINI_STR())
+  typedef void (*EdgeHandler)(); ///< edge interrupt handler
+  typedef unsigned long (*ClockFunction)(); ///< returns the time (us)
+  typedef void (*DelayFunction)(unsigned long us); ///< waits us microseconds
+  typedef void (*PinHook)(uint8_t pin, bool value); ///< called on pin write
+  typedef void (*SleepHook)(); ///< waits until the next interrupt
+
+  static unsigned long micros();
+  static void delayMicros(unsigned long us);
+  /*!
+      @brief  wait a number of milliseconds
+      @param ms the number of milliseconds to wait
+  */
+  static inline void delayMillis(unsigned long ms) {
+    delayMicros(ms * 1000UL);
+  };
+  static void setClock(ClockFunction clock, DelayFunction delay);
+
+  static void pinInput(uint8_t pin);
+  static void pinOutput(uint8_t pin, bool value);
+  static bool readPin(uint8_t pin);
+  static void writePin(uint8_t pin, bool value);
+  static void setPinHook(PinHook hook);
+
+  static int edgeInterrupt(uint8_t pin);
+  static void attachRisingEdge(uint8_t irq, EdgeHandler handler);
+  static void detachEdge(uint8_t irq);
+  static void raiseEdge(uint8_t irq);
+
+  static void disableInterrupts();
+  static void enableInterrupts();
+  static void sleepIdle();
+  static void setSleepHook(SleepHook hook);
+
+  static void error(Message msg);
+  static void pinError(uint8_t pin, Message msg);
+
+  /*!
+      @brief  critical section (see GEMINI_CRITICAL_SECTION())
+      @details interrupts (edges raised with raiseEdge()) are deferred until
+     the end of the outermost critical section
+  */
+  class CriticalSection {
+  public:
+    CriticalSection();
+    ~CriticalSection();
+    /*!
+        @brief  used to execute the block once
+        @return true the first time, false afterwards
+    */
+    bool once() { return first ? !(first = false) : false; };
+
+  private:
+    bool first = true; ///< true until the block has been executed
+  };
+};
+
+/*!
+ * @brief same as the AVR libc function
+ * @param value the value to convert
+ * @param buffer the destination buffer
+ * @param radix the base (2 to 36)
+ * @return buffer
+ */
+char *ultoa(unsigned long value, char *buffer, int radix);
+
+#endif // ARDUINO
+
+#endif // K197CTRL_GEMINI_HAL_H
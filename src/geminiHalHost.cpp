@@ -0,0 +1,269 @@
+/**************************************************************************/
+/*!
+  @file     geminiHalHost.cpp
+
+  Arduino K197Control library sketch
+
+  Copyright (C) 2023 by ALX2009
+
+  License: MIT (see LICENSE)
+
+  This file is part of the Arduino K197control library, please see
+  https://github.com/alx2009/K197Control for more information
+
+  Note: this file implements the host version of the class GeminiHal. It is
+  not used when compiling for Arduino.
+*/
+#ifndef ARDUINO
+
+#include <stdio.h>
+#include <time.h>
+
+#include "geminiHal.h"
+
+static GeminiHal::ClockFunction clockFunction = NULL; ///< simulated clock
+static GeminiHal::DelayFunction delayFunction = NULL; ///< simulated delay
+static GeminiHal::PinHook pinHook = NULL;             ///< pin write hook
+static GeminiHal::SleepHook sleepHook = NULL;         ///< simulated sleep
+
+static bool pinLevel[GEMINI_HOST_PINS];   ///< simulated pin levels
+static bool pinIsOutput[GEMINI_HOST_PINS]; ///< simulated pin directions
+
+static GeminiHal::EdgeHandler
+    edgeHandlers[GEMINI_EDGE_INTERRUPTS]; ///< edge interrupt handlers
+static uint8_t pendingEdges[GEMINI_EDGE_INTERRUPTS]; ///< deferred edges
+static unsigned criticalSectionDepth = 0; ///< critical section nesting
+
+/*!
+     @brief  get the current time
+     @return the number of microseconds since an arbitrary point in time
+*/
+unsigned long GeminiHal::micros() {
+  if (clockFunction != NULL) {
+    return clockFunction();
+  }
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long)ts.tv_sec * 1000000UL +
+         (unsigned long)(ts.tv_nsec / 1000L);
+}
+
+/*!
+     @brief  wait a number of microseconds
+     @param us the number of microseconds to wait
+*/
+void GeminiHal::delayMicros(unsigned long us) {
+  if (delayFunction != NULL) {
+    delayFunction(us);
+    return;
+  }
+  unsigned long start = micros();
+  while (micros() - start < us) {
+    // busy wait, like delayMicroseconds()
+  }
+}
+
+/*!
+     @brief  replace the clock and the delay function (e.g. for a simulation)
+     @param clock returns the current time in microseconds (NULL = host clock)
+     @param delay waits a number of microseconds (NULL = busy wait)
+*/
+void GeminiHal::setClock(ClockFunction clock, DelayFunction delay) {
+  clockFunction = clock;
+  delayFunction = delay;
+}
+
+/*!
+     @brief  configure a pin as input
+     @param pin the pin number
+*/
+void GeminiHal::pinInput(uint8_t pin) {
+  if (pin < GEMINI_HOST_PINS) {
+    pinIsOutput[pin] = false;
+  }
+}
+
+/*!
+     @brief  configure a pin as output, setting its initial value
+     @param pin the pin number
+     @param value the initial value
+*/
+void GeminiHal::pinOutput(uint8_t pin, bool value) {
+  if (pin < GEMINI_HOST_PINS) {
+    pinIsOutput[pin] = true;
+    writePin(pin, value);
+  }
+}
+
+/*!
+     @brief  read a pin
+     @param pin the pin number
+     @return the pin level
+*/
+bool GeminiHal::readPin(uint8_t pin) {
+  return pin < GEMINI_HOST_PINS ? pinLevel[pin] : false;
+}
+
+/*!
+     @brief  write a pin
+     @details for an input pin, this sets the level seen by readPin(), i.e. it
+   simulates the external signal. No edge interrupt is raised, use raiseEdge()
+     @param pin the pin number
+     @param value the pin level
+*/
+void GeminiHal::writePin(uint8_t pin, bool value) {
+  if (pin >= GEMINI_HOST_PINS) {
+    return;
+  }
+  pinLevel[pin] = value;
+  if (pinIsOutput[pin] && pinHook != NULL) {
+    pinHook(pin, value);
+  }
+}
+
+/*!
+     @brief  set a function called every time an output pin is written
+     @param hook the function to call (NULL = none)
+*/
+void GeminiHal::setPinHook(PinHook hook) { pinHook = hook; }
+
+/*!
+     @brief  get the interrupt number for a pin
+     @param pin the pin number
+     @return the interrupt number, or -1 if the pin cannot detect edges
+*/
+int GeminiHal::edgeInterrupt(uint8_t pin) {
+  return pin < GEMINI_EDGE_INTERRUPTS ? pin : -1;
+}
+
+/*!
+     @brief  attach a handler to the rising edge of an interrupt
+     @param irq the interrupt number
+     @param handler the interrupt handler
+*/
+void GeminiHal::attachRisingEdge(uint8_t irq, EdgeHandler handler) {
+  if (irq < GEMINI_EDGE_INTERRUPTS) {
+    edgeHandlers[irq] = handler;
+    pendingEdges[irq] = 0;
+  }
+}
+
+/*!
+     @brief  detach the handler of an interrupt
+     @param irq the interrupt number
+*/
+void GeminiHal::detachEdge(uint8_t irq) {
+  if (irq < GEMINI_EDGE_INTERRUPTS) {
+    edgeHandlers[irq] = NULL;
+    pendingEdges[irq] = 0;
+  }
+}
+
+/*!
+     @brief  simulate a rising edge interrupt
+     @details the handler is called immediately, unless a critical section is
+   in progress. In such a case it is called at the end of the critical section
+     @param irq the interrupt number
+*/
+void GeminiHal::raiseEdge(uint8_t irq) {
+  if (irq >= GEMINI_EDGE_INTERRUPTS || edgeHandlers[irq] == NULL) {
+    return;
+  }
+  if (criticalSectionDepth > 0) {
+    pendingEdges[irq]++;
+    return;
+  }
+  edgeHandlers[irq]();
+}
+
+/*!
+     @brief  print an error message
+     @param msg the message
+*/
+void GeminiHal::error(Message msg) { fprintf(stderr, "%s\n", msg); }
+
+/*!
+     @brief  print an error message about a pin
+     @param pin the pin number
+     @param msg the message
+*/
+void GeminiHal::pinError(uint8_t pin, Message msg) {
+  fprintf(stderr, "Error: Pin %u%s\n", (unsigned)pin, msg);
+}
+
+/*!
+     @brief  disable interrupts: edges raised with raiseEdge() are deferred
+   until enableInterrupts() is called (calls can be nested)
+*/
+void GeminiHal::disableInterrupts() { criticalSectionDepth++; }
+
+/*!
+     @brief  enable interrupts, calling the deferred edge handlers
+*/
+void GeminiHal::enableInterrupts() {
+  if (criticalSectionDepth == 0 || --criticalSectionDepth > 0) {
+    return;
+  }
+  for (uint8_t irq = 0; irq < GEMINI_EDGE_INTERRUPTS; irq++) {
+    while (pendingEdges[irq] > 0 && criticalSectionDepth == 0) {
+      pendingEdges[irq]--;
+      if (edgeHandlers[irq] != NULL) {
+        edgeHandlers[irq]();
+      }
+    }
+  }
+}
+
+/*!
+     @brief  sleep until the next interrupt
+     @details must be called with interrupts disabled (see
+   disableInterrupts()), returns with interrupts enabled. If an edge was
+   deferred, its handler is called and the function returns immediately.
+   Otherwise the sleep hook is called (e.g. a simulation advancing the
+   virtual clock to the next event). Without a sleep hook the function
+   returns immediately, as if woken by a timer interrupt.
+*/
+void GeminiHal::sleepIdle() {
+  bool pending = false;
+  for (uint8_t irq = 0; irq < GEMINI_EDGE_INTERRUPTS; irq++) {
+    pending = pending || (pendingEdges[irq] > 0);
+  }
+  enableInterrupts();
+  if (!pending && sleepHook != NULL) {
+    sleepHook();
+  }
+}
+
+/*!
+     @brief  set the function called by sleepIdle() to wait for an interrupt
+     @param hook the function to call (NULL = return immediately)
+*/
+void GeminiHal::setSleepHook(SleepHook hook) { sleepHook = hook; }
+
+/*!
+     @brief  enter a critical section
+*/
+GeminiHal::CriticalSection::CriticalSection() { disableInterrupts(); }
+
+/*!
+     @brief  exit a critical section, calling the deferred edge handlers
+*/
+GeminiHal::CriticalSection::~CriticalSection() { enableInterrupts(); }
+
+char *ultoa(unsigned long value, char *buffer, int radix) {
+  char tmp[sizeof(unsigned long) * 8 + 1];
+  int i = 0;
+  do {
+    int digit = (int)(value % (unsigned long)radix);
+    tmp[i++] = (char)(digit < 10 ? '0' + digit : 'a' + digit - 10);
+    value /= (unsigned long)radix;
+  } while (value != 0);
+  int j = 0;
+  while (i > 0) {
+    buffer[j++] = tmp[--i];
+  }
+  buffer[j] = '\0';
+  return buffer;
+}
+
+#endif // ARDUINO
@@ -0,0 +1,150 @@
+/**************************************************************************/
+/*!
+  @file     geminiHistogram.h
+
+  Arduino K197Control library
+
+  Copyright (C) 2023 by ALX2009
+
+  License: MIT (see LICENSE)
+
+  This file is part of the Arduino K197Display sketch, please see
+  https://github.com/alx2009/K197Control for more information
+
+  This file defines the GeminiHistogram class
+  The GeminiHistogram class counts time intervals in log2 buckets, so that
+  the gemini protocol can report where the time goes on the wire (see
+  GeminiHistograms)
+
+*/
+/**************************************************************************/
+#ifndef K197CTRL_GEMINI_HISTOGRAM_H
+#define K197CTRL_GEMINI_HISTOGRAM_H
+
+#include "geminiHal.h"
+
+// uncomment the following definition to enable the timing histograms. They
+// use 160 bytes of RAM in each gemini object
+//#define GEMINI_HISTOGRAMS ///< when defined, collect the timing histograms
+
+#define GEMINI_HISTOGRAM_BUCKETS 20 ///< number of buckets in a histogram
+
+/*!
+      @brief histogram of time intervals, with log2 buckets in microseconds
+
+      @details bucket 0 counts the intervals of 0 us, bucket n (1 to 18) the
+   intervals from 2^(n-1) to 2^n - 1 us, the last bucket the intervals of
+   262144 us or more (enough for a whole frame). The counters saturate at
+   65535.
+
+      add() only takes a few comparisons and shifts, so it can be called in
+   the protocol hot path and in interrupt context.
+*/
+class GeminiHistogram {
+public:
+  /*!
+      @brief  get the bucket of a time interval
+      @param us the interval in microseconds
+      @return the bucket number (0 to GEMINI_HISTOGRAM_BUCKETS - 1)
+  */
+  static inline uint8_t bucket(unsigned long us) {
+    if (us >= (1UL << (GEMINI_HISTOGRAM_BUCKETS - 2))) {
+      return GEMINI_HISTOGRAM_BUCKETS - 1;
+    }
+    uint32_t v = us;
+    uint8_t b = 0;
+    if (v & 0xffff0000UL) {
+      b = 16;
+      v >>= 16;
+    }
+    if (v & 0xff00) {
+      b += 8;
+      v >>= 8;
+    }
+    if (v & 0xf0) {
+      b += 4;
+      v >>= 4;
+    }
+    if (v & 0x0c) {
+      b += 2;
+      v >>= 2;
+    }
+    if (v & 0x02) {
+      b += 1;
+      v >>= 1;
+    }
+    return b + (uint8_t)v;
+  };
+  /*!
+      @brief  get the smallest interval counted in a bucket
+      @param b the bucket number
+      @return the lower bound of the bucket in microseconds
+  */
+  static unsigned long lowerBound(uint8_t b) {
+    return b == 0 ? 0 : 1UL << (b - 1);
+  };
+
+  /*!
+      @brief  count a time interval
+      @param us the interval in microseconds
+  */
+  inline void add(unsigned long us) {
+    uint16_t &counter = counts[bucket(us)];
+    if (counter != 0xffff) {
+      counter++;
+    }
+  };
+  /*!
+      @brief  get the count of a bucket
+      @param b the bucket number
+      @return the number of intervals counted in the bucket
+  */
+  uint16_t getCount(uint8_t b) const {
+    return b < GEMINI_HISTOGRAM_BUCKETS ? counts[b] : 0;
+  };
+  /*!
+      @brief  get the total count
+      @return the number of intervals counted in all the buckets
+  */
+  unsigned long getTotal() const {
+    unsigned long total = 0;
+    for (uint8_t b = 0; b < GEMINI_HISTOGRAM_BUCKETS; b++) {
+      total += counts[b];
+    }
+    return total;
+  };
+  /*!
+      @brief  reset all the counters
+  */
+  void reset() { memset(counts, 0, sizeof(counts)); };
+
+private:
+  uint16_t counts[GEMINI_HISTOGRAM_BUCKETS] = {}; ///< the counters
+};
+
+/*!
+      @brief the timing histograms of a gemini object
+
+      @details see GeminiProtocolT::getHistograms()
+*/
+struct GeminiHistograms {
+  GeminiHistogram readDelay; ///< edge (or end of our write) to bit sample,
+                             ///< compare with readDelayMicros
+  GeminiHistogram ackWait; ///< bit written to acknowledge edge from the peer
+  GeminiHistogram bitGap;  ///< end of a bit to the edge of the next bit of the
+                           ///< same frame (time waiting for the peer)
+  GeminiHistogram frameDuration; ///< first bit of a frame to frameComplete()
+                                 ///< (GeminiFrameT only)
+
+  /*!
+      @brief  reset all the histograms
+  */
+  void reset() {
+    readDelay.reset();
+    ackWait.reset();
+    bitGap.reset();
+    frameDuration.reset();
+  };
+};
+
+#endif // K197CTRL_GEMINI_HISTOGRAM_H
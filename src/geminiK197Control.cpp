@@ -11,92 +11,28 @@
   This file is part of the Arduino K197control library, please see
   https://github.com/alx2009/K197Control for more information
 
-  Note: this file implements the class geminiProtocol
+  Note: this file implements the K197 data structures used by the class
+  GeminiK197ControlT (the class itself is a template, implemented in
+  geminiK197Control.h)
 */
 #include "geminiK197Control.h"
 
-static GeminiK197Control::K197measurement
-    defaultMeasurementResult; ///< default meaurement buffer
-static GeminiK197Control::K197control
-    defaultControlRequest; ///< default control buffer
-
-/*!
-     @brief  initialize the object.
-
-     @details begin should be called before using the object
-
-     When begin is called without any argument, global default measurement
-   (input) and control (output) objects are used. Note that all instances of the
-   object will share the same global default objects
-
-     PREREQUISITES: Serial.begin must be called to see any error message
-
-     @return true if the call was succesful and the object can be used, false
-   otherwise
-*/
-bool GeminiK197Control::begin() {
-  return begin(&defaultMeasurementResult, &defaultControlRequest);
-}
-
-/*!
-     @brief  initialize the object.
-
-     @details begin should be called before using the object
-
-     When begin is called with a single argument, NO control (output) buffer is
-   assigned. This can be useful in case the object is only used for retrieving
-   measurement result. Alternatively, a control buffer can be set with
-   setControlBuffer(), or the application can include a control object directly
-   in sendImmediately.
-
-     @param newInputBuffer pointer to a measurement (input) buffer to receive
-   measurement results
-     @return true if the call was succesful and the object can be used, false
-   otherwise
-*/
-bool GeminiK197Control::begin(K197measurement *newInputBuffer) {
-  setControlBuffer(NULL, false);
-  inputBuffer = newInputBuffer;
-  return GeminiFrame::begin((uint8_t *)inputBuffer,
-                            sizeof(K197measurement) / sizeof(uint8_t));
-}
-
-/*!
-     @brief  initialize the object.
-
-     @details begin should be called before using the object
-
-     When begin is called with two arguments, it is possible to use
-   sendImmediately() without arguments and/or execute() to send a control frame
-   to the K197. The application can also include a different control object
-   directly in sendImmediately.
-
-     @param newInputBuffer pointer to a measurement (input) buffer to receive
-   measurement results
-     @param newOutputBuffer pointer to a control (output) buffer that will be
-   used as default for this object
-     @return true if the call was succesful and the object can be used, false
-   otherwise
-*/
-bool GeminiK197Control::begin(K197measurement *newInputBuffer,
-                              K197control *newOutputBuffer) {
-  setControlBuffer(newOutputBuffer, true);
-  inputBuffer = newInputBuffer;
-  return GeminiFrame::begin((uint8_t *)inputBuffer,
-                            sizeof(K197measurement) / sizeof(uint8_t));
-}
+GeminiK197Types::K197measurement
+    GeminiK197Types::defaultMeasurementResult; ///< default meaurement buffer
+GeminiK197Types::K197control
+    GeminiK197Types::defaultControlRequest; ///< default control buffer
 
 /****************************************************************************
 ***********          MEASUREMENT RESULT STRUCTURE                *************
 *****************************************************************************/
 
-const size_t GeminiK197Control::K197measurement::valueAsStringMinSize =
+const size_t GeminiK197Types::K197measurement::valueAsStringMinSize =
     12; ///< char[] lenght required by getValueAsString (incl. term. NULL)
-const size_t GeminiK197Control::K197measurement::resultAsStringMinSize =
+const size_t GeminiK197Types::K197measurement::resultAsStringMinSize =
     16; ///< char[] lenght required by getResultAsString (incl. term. NULL)
-const size_t GeminiK197Control::K197measurement::valueAsStringMinSizeER =
+const size_t GeminiK197Types::K197measurement::valueAsStringMinSizeER =
     14; ///< char[] lenght required by getValueAsStringER (incl. term. NULL)
-const size_t GeminiK197Control::K197measurement::resultAsStringMinSizeER =
+const size_t GeminiK197Types::K197measurement::resultAsStringMinSizeER =
     18; ///< char[] lenght required by getResultAsStringER (incl. term. NULL)
 
 static double range_power[]{
@@ -115,7 +51,7 @@ static int8_t range_baseline[]{3, 6, 0, 0}; ///< used for internal calculations
    for the K197 IEEE-488 for more information
      @return a null terminated char array with the unit
 */
-const char *GeminiK197Control::K197measurement::getUnitString() const {
+const char *GeminiK197Types::K197measurement::getUnitString() const {
   switch (byte0.unit) {
   case K197unit::Volt:
     return byte0.ac_dc ? "ACV" : "DCV";
@@ -141,7 +77,7 @@ const char *GeminiK197Control::K197measurement::getUnitString() const {
 
      @return the exponent to use in combination with unit, etc.
 */
-int8_t GeminiK197Control::K197measurement::getValueExponent() const {
+int8_t GeminiK197Types::K197measurement::getValueExponent() const {
   return range_exponent[range_baseline[byte0.unit] + byte0.range];
 }
 
@@ -156,7 +92,7 @@ int8_t GeminiK197Control::K197measurement::getValueExponent() const {
    absolute value would be 200000
      @return value of the measurement as unsigned long integer
 */
-unsigned long GeminiK197Control::K197measurement::getAbsValue() const {
+unsigned long GeminiK197Types::K197measurement::getAbsValue() const {
   uint64_t uuvalue = getCount();
   uuvalue = uuvalue * 3125; // multiply first to avoid losing accuracy. This is
                             // why we need a 64 bit integer...
@@ -171,7 +107,7 @@ unsigned long GeminiK197Control::K197measurement::getAbsValue() const {
    mV, the value would be -200000
      @return value of the measurement as long integer
 */
-long GeminiK197Control::K197measurement::getValue() const {
+long GeminiK197Types::K197measurement::getValue() const {
   return byte1.negative ? -getAbsValue() : getAbsValue();
 }
 
@@ -186,7 +122,7 @@ long GeminiK197Control::K197measurement::getValue() const {
    precision of  a float, which is barely adequate for this purpose
      @return value of the measurement as double
 */
-double GeminiK197Control::K197measurement::getValueAsDouble() const {
+double GeminiK197Types::K197measurement::getValueAsDouble() const {
   return double(getValue()) *
          range_power[range_baseline[byte0.unit] + byte0.range];
 }
@@ -202,7 +138,7 @@ double GeminiK197Control::K197measurement::getValueAsDouble() const {
    least K197measurement::valueAsStringMinSize elements
      @return value of the measurement as null terminated char array
 */
-char *GeminiK197Control::K197measurement::getValueAsString(char *buffer) const {
+char *GeminiK197Types::K197measurement::getValueAsString(char *buffer) const {
   char *tmpbuf = buffer;
   uint32_t uvalue = getAbsValue();
   tmpbuf[0] = isNegative() ? '-' : '+';
@@ -235,7 +171,7 @@ char *GeminiK197Control::K197measurement::getValueAsString(char *buffer) const {
      @return value of the measurement as null terminated char array
 */
 char *
-GeminiK197Control::K197measurement::getResultAsString(char *buffer) const {
+GeminiK197Types::K197measurement::getResultAsString(char *buffer) const {
   char *tmpbuf = buffer;
   tmpbuf[0] = byte1.ovrange ? 'O' : isZero() ? 'Z' : 'N';
   tmpbuf++;
@@ -270,7 +206,7 @@ GeminiK197Control::K197measurement::getResultAsString(char *buffer) const {
    the absolute value ER would be 20000000
      @return value ER of the measurement as unsigned long integer
 */
-unsigned long GeminiK197Control::K197measurement::getAbsValueER() const {
+unsigned long GeminiK197Types::K197measurement::getAbsValueER() const {
   uint64_t uuvalue = getCount();
   uuvalue = uuvalue * 78125; // multiply first to avoid losing accuracy. This is
                              // why we need a 64 bit integer...
@@ -289,7 +225,7 @@ unsigned long GeminiK197Control::K197measurement::getAbsValueER() const {
    would be -20000000
      @return value ER of the measurement as a long integer
 */
-long GeminiK197Control::K197measurement::getValueER() const {
+long GeminiK197Types::K197measurement::getValueER() const {
   return byte1.negative ? -getAbsValueER() : getAbsValueER();
 }
 
@@ -313,7 +249,7 @@ long GeminiK197Control::K197measurement::getValueER() const {
    microcontroller architecture supporting true double precision math
      @return value ER of the measurement as double
 */
-double GeminiK197Control::K197measurement::getValueAsDoubleER() const {
+double GeminiK197Types::K197measurement::getValueAsDoubleER() const {
   return double(getValueER()) *
          range_power[range_baseline[byte0.unit] + byte0.range] * 0.01;
 }
@@ -335,7 +271,7 @@ double GeminiK197Control::K197measurement::getValueAsDoubleER() const {
      @return value ER of the measurement as null terminated char array
 */
 char *
-GeminiK197Control::K197measurement::getValueAsStringER(char *buffer) const {
+GeminiK197Types::K197measurement::getValueAsStringER(char *buffer) const {
   char *tmpbuf = buffer;
   uint32_t uvalue = getAbsValueER();
   tmpbuf[0] = isNegative() ? '-' : '+';
@@ -369,7 +305,7 @@ GeminiK197Control::K197measurement::getValueAsStringER(char *buffer) const {
      @return value ER of the measurement as null terminated char array
 */
 char *
-GeminiK197Control::K197measurement::getResultAsStringER(char *buffer) const {
+GeminiK197Types::K197measurement::getResultAsStringER(char *buffer) const {
   char *tmpbuf = buffer;
   tmpbuf[0] = byte1.ovrange ? 'O' : isZero() ? 'Z' : 'N';
   tmpbuf++;
@@ -395,11 +331,11 @@ GeminiK197Control::K197measurement::getResultAsStringER(char *buffer) const {
 
 /*!
      @brief  set the range
-     @details set the range (see GeminiK197Control::K197range for possible
+     @details set the range (see GeminiK197Types::K197range for possible
    values).
      @param range the range to set
 */
-void GeminiK197Control::K197control::setRange(K197range range) {
+void GeminiK197Types::K197control::setRange(K197range range) {
   byte0.range = range;
   byte0.set_range = true;
 }
@@ -408,7 +344,7 @@ void GeminiK197Control::K197control::setRange(K197range range) {
      @brief  set relative or absolute mode
      @param isRelative true (default) set relative mode. False set absolute mode
 */
-void GeminiK197Control::K197control::setRelative(bool isRelative) {
+void GeminiK197Types::K197control::setRelative(bool isRelative) {
   byte0.relative = isRelative;
   byte0.set_rel = true;
 }
@@ -418,18 +354,18 @@ void GeminiK197Control::K197control::setRelative(bool isRelative) {
      @details set decibel or Volt mode
      @param is_dB true (default) set dB mode. False set Volt mode
 */
-void GeminiK197Control::K197control::setDbMode(bool is_dB) {
+void GeminiK197Types::K197control::setDbMode(bool is_dB) {
   byte0.dB = is_dB;
   byte0.set_db = true;
 }
 
 /*!
      @brief  set the trigger mode
-     @details set the trigger mode (see GeminiK197Control::K197triggerMode for
+     @details set the trigger mode (see GeminiK197Types::K197triggerMode for
    possible values).
      @param triggerMode the trigger mode
 */
-void GeminiK197Control::K197control::setTriggerMode(
+void GeminiK197Types::K197control::setTriggerMode(
     K197triggerMode triggerMode) {
   byte1.trigger = triggerMode;
   byte1.set_trigger = true;
@@ -439,7 +375,7 @@ void GeminiK197Control::K197control::setTriggerMode(
      @brief  set remote or local mode
      @param isRemote true (default) set remote mode. False set local mode
 */
-void GeminiK197Control::K197control::setRemoteMode(bool isRemote) {
+void GeminiK197Types::K197control::setRemoteMode(bool isRemote) {
   byte1.ctrl_mode = isRemote;
   byte1.set_ctrl_mode = true;
 }
@@ -449,47 +385,7 @@ void GeminiK197Control::K197control::setRemoteMode(bool isRemote) {
      @param sendStored true (default) set stored reading mode. False set
    displayed reading mode
 */
-void GeminiK197Control::K197control::setSendStoredReadings(bool sendStored) {
+void GeminiK197Types::K197control::setSendStoredReadings(bool sendStored) {
   byte2.sent_readings = sendStored;
   byte2.set_sent_readings = true;
 }
-
-/*!
-     @brief  simulate startup handshake from a real 488 card
-     @details this function will wait for a startup pulse from the K197 and then
-     try to simulate the startup handshake observed with a real 488 card
-     In the limited tests done (only one instrument tested), it is not required.
-     It is provided in case it may be required (e.g. due to different firmware
-   revision)
-     @param timeout_micros how much to wait for the startup pulse from K197
-   (timeout_micros=0 means wait forever)
-     @return true if the handshake was succesful, false otherwise
-*/
-bool GeminiK197Control::serverStartup(unsigned long timeout_micros) {
-  if (timeout_micros != 0) {
-    if (!waitInputEdge(timeout_micros)) {
-      return false;
-    }
-  } else {
-    waitInputEdge();
-  }
-  pulse(1684);
-  delayMicroseconds(60);
-  pulse(20);
-
-  if (!waitInputIdle(50000UL)) {
-    return false;
-  }
-  delay(35);
-
-  uint8_t initial_data = 0x80;
-  send(initial_data);
-  send(false);
-
-  while (hasData(9) == false)
-    update();
-  // delayMicroseconds(100);
-  pulse(30);
-  setInitiatorMode(false);
-  return true;
-}
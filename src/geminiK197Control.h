@@ -22,73 +22,36 @@
 #define K197CTRL_GEMINI_K197_CONTROL_H
 #include "geminiFrame.h"
 
-/*!
-      @brief handles communications with a K197 voltmeter using the interface
-   used by the IEEE-488 option card
-
-      @details the K197 can be equipped with an optional IEEE-488 card. This
-   card communicates with the K197 main board with a 2 wire interface. This
-   class implements the application layer of this 2 wire interface.
-
-      The class uses the gemini protocol inherithed by the base classes to
-   receive measurement results and send control commands to the K197.
+#define K197_CALIBRATION_FRAMES                                                \
+  4 ///< default number of frames without errors to accept a timing step
+#ifdef GEMINI_USE_TIMER1
+#define K197_CALIBRATION_MIN_MICROS                                            \
+  GEMINI_TIMER_MIN_MICROS ///< the calibration does not go below this value
+                          ///< (shorter Timer1 delays are not generated)
+#else
+#define K197_CALIBRATION_MIN_MICROS                                            \
+  2 ///< the calibration does not go below this value (microseconds)
+#endif // GEMINI_USE_TIMER1
+#define K197_CALIBRATION_MARGIN_PERCENT                                        \
+  25 ///< margin added to the fastest stable value of each parameter
+#define K197_CALIBRATION_MARGIN_MICROS                                         \
+  4 ///< minimum margin added to the fastest stable value (microseconds)
 
-      After construction, begin() must be called before using any other
-   function. Then update() must be called on a regular basis.
-
-      When a measurement is received, it is stored in a K197measurement buffer.
-   FrameComplete() in the base class can be used to know when a new frame has
-   been received. One of the methods resetFrame() or getFrame() in the base
-   class must be called before a new frame can be received.
+/*!
+      @brief data structures used to communicate with a K197 voltmeter
 
-      To send control commands two methods can be used:
-      - execute() queues the commands currently stored in the current control
-   structure to be sent as soon as possible as a new frame. This is the
-   recommended (and safer) way to control the k197. The current control buffer
-   is the one specified at begin() or using setControlBuffer
-      - sendImmediately() will queue the specified control buffer structure
-   immediately. With this method the caller must make sure that there isn't a
-   transmission already queued or ongoing, otherwise the effect can be
-   unpredictable. It is recommended that the caller make sure both
-   isFrameEndDetected() and noOutputPending() return true before calling
-   sendImmediately().
+      @details this class defines the measurement result (K197measurement) and
+   control (K197control) frame structures, with the related enumerations. It
+   is a base class of GeminiK197ControlT, so the types can be accessed as
+   GeminiK197Control::K197measurement, GeminiK197Control::K197control etc.
+   regardless of the template parameters.
 */
-class GeminiK197Control : public GeminiFrame {
+class GeminiK197Types {
 public:
-  /*!
-      @brief  constructor for the class.
-
-      @details See protocol specification for more information about the
-     protocol and its timing Note that handshakeTimeoutMicros is not implemented
-     yet
-
-      @param inputPin input pin. Must be able to detect an edge interrupt (on a
-     UNO, only pin 2 and 3 can be used)
-      @param outputPin output pin. any I/O pin can be used
-      @param writePulseMicros minimum duration of the write pulse
-      @param handshakeTimeoutMicros timeout for handshakes. If no handshake
-     received the transmission is aborted
-      @param readDelayMicros delay from the time an edge is detected on the
-     input pin, to the time the bit value is read
-      @param writeDelayMicros minimum time when writing. After an edge is
-     detected on the input pin (signaling the other peer has read the value on
-     the output pin), wait at least writeDelayMicros before returning the
-     outpout pin to LOW
-  */
-  GeminiK197Control(uint8_t inputPin, uint8_t outputPin,
-                    unsigned long writePulseMicros,
-                    unsigned long handshakeTimeoutMicros,
-                    unsigned long readDelayMicros,
-                    unsigned long writeDelayMicros)
-      : GeminiFrame(inputPin, outputPin, writePulseMicros,
-                    handshakeTimeoutMicros, readDelayMicros, writeDelayMicros) {
-
-  }
-
   /*!
       @brief  Define the measurement unit
   */
-  enum K197unit {
+  enum K197unit : uint8_t {
     Volt = 0b00, ///< Volt
     Amp = 0b10,  ///< Ampere
     Ohm = 0b01,  ///< Ohm
@@ -146,7 +109,7 @@ public:
      the actual measurement range (auto range is never returned) See the
      instruction manual for the K197 IEEE-488 for more information
   */
-  enum K197range {
+  enum K197range : uint8_t {
     R0_Auto = 0b000,      ///< send: auto range
     R1_200mV_Ohm = 0b001, ///< send: 200 mV/Ohm receive: 200 mV/Ohm/uA
     R2_2V_KOhm = 0b010,   ///< send: 2 V/KOhm receive: 2 V/KOhm/mA
@@ -332,7 +295,7 @@ public:
      we define other constants that are used to actually trigger the measure
       (corresponding to TALK/GET bus commands)
   */
-  enum K197triggerMode {
+  enum K197triggerMode : uint8_t {
     invalid_000 = 0b000,    ///< not used
     invalid_001 = 0b001,    ///< not used
     T0_Cont_onTALK = 0b010, ///< when set, send T_TALK to trigger
@@ -476,6 +439,223 @@ public:
     };
   };
 
+protected:
+  static K197measurement
+      defaultMeasurementResult;               ///< default meaurement buffer
+  static K197control defaultControlRequest; ///< default control buffer
+};
+
+/*!
+      @brief a queue of K197 measurements
+
+      @details a ring buffer with N measurement slots. Measurements are pushed
+   by GeminiK197ControlT as soon as a frame has been received, and they can be
+   pulled by the application at its own pace. When the queue is full new
+   measurements are dropped and counted as overruns.
+
+      @tparam N the number of slots in the queue (0 = no queue)
+*/
+template <uint8_t N> class K197measurementQueue {
+public:
+  /*!
+      @brief  store a copy of a measurement in the queue, if there is space left
+      @param measurement the measurement to store
+      @return true if the measurement was stored, false otherwise (queue full,
+     overrun counter incremented)
+  */
+  bool push(const GeminiK197Types::K197measurement &measurement) {
+    if (count >= N) {
+      overruns++;
+      return false; // queue full
+    }
+    uint8_t tail = head + count;
+    if (tail >= N) {
+      tail -= N;
+    }
+    slots[tail] = measurement;
+    count++;
+    return true;
+  };
+  /*!
+      @brief  remove the oldest measurement from the queue
+      @param measurement pointer to a measurement where to copy the oldest
+     measurement stored in the queue
+      @return true if a measurement was copied, false otherwise (queue empty)
+  */
+  bool pull(GeminiK197Types::K197measurement *measurement) {
+    if (count == 0) {
+      return false; // queue empty
+    }
+    *measurement = slots[head];
+    head++;
+    if (head >= N) {
+      head = 0;
+    }
+    count--;
+    return true;
+  };
+  /*!
+      @brief  get the number of measurements in the queue
+      @return the number of measurements in the queue
+  */
+  uint8_t size() const { return count; };
+
+  unsigned long overruns = 0; ///< number of measurements dropped (queue full)
+
+private:
+  GeminiK197Types::K197measurement slots[N]; ///< measurement slots
+  uint8_t head = 0;  ///< index of the oldest measurement in the queue
+  uint8_t count = 0; ///< number of measurements in the queue
+};
+
+/*!
+      @brief an empty measurement queue (the queue is not used)
+*/
+template <> class K197measurementQueue<0> {
+public:
+  /*!
+      @brief  store a measurement (never done, the queue has no slots)
+      @return always false
+  */
+  bool push(const GeminiK197Types::K197measurement &) { return false; };
+  /*!
+      @brief  remove the oldest measurement (never done, the queue is empty)
+      @return always false
+  */
+  bool pull(GeminiK197Types::K197measurement *) { return false; };
+  /*!
+      @brief  get the number of measurements in the queue
+      @return always 0
+  */
+  uint8_t size() const { return 0; };
+
+  unsigned long overruns = 0; ///< number of measurements dropped (always 0)
+};
+
+/*!
+      @brief handles communications with a K197 voltmeter using the interface
+   used by the IEEE-488 option card
+
+      @details the K197 can be equipped with an optional IEEE-488 card. This
+   card communicates with the K197 main board with a 2 wire interface. This
+   class implements the application layer of this 2 wire interface.
+
+      The class uses the gemini protocol inherithed by the base classes to
+   receive measurement results and send control commands to the K197.
+
+      After construction, begin() must be called before using any other
+   function. Then update() must be called on a regular basis.
+
+      When a measurement is received, it is stored in a K197measurement buffer.
+   FrameComplete() in the base class can be used to know when a new frame has
+   been received. One of the methods resetFrame() or getFrame() in the base
+   class must be called before a new frame can be received.
+
+      Alternatively, a measurement queue can be enabled with the template
+   parameter MEASUREMENT_QUEUE_SIZE. In such a case, update() copies every
+   received measurement into the queue (frameComplete() will never return true
+   to the application) and the application retrieves them with
+   popMeasurement(). Measurements received when the queue is full are counted
+   as overruns, see getMeasurementOverrunCounter().
+
+      To send control commands two methods can be used:
+      - execute() queues the commands currently stored in the current control
+   structure to be sent as soon as possible as a new frame. This is the
+   recommended (and safer) way to control the k197. The current control buffer
+   is the one specified at begin() or using setControlBuffer
+      - sendImmediately() will queue the specified control buffer structure
+   immediately. With this method the caller must make sure that there isn't a
+   transmission already queued or ongoing, otherwise the effect can be
+   unpredictable. It is recommended that the caller make sure both
+   isFrameEndDetected() and noOutputPending() return true before calling
+   sendImmediately().
+
+      GeminiK197Control is the same class with the default FIFO sizes.
+
+      @tparam INPUT_SIZE size of the input FIFO in bits (power of two)
+      @tparam OUTPUT_SIZE size of the output FIFO in bits (power of two)
+      @tparam MEASUREMENT_QUEUE_SIZE number of slots in the measurement queue
+     (0 = no queue)
+      @tparam PINS the pin I/O class (see GeminiProtocolT)
+*/
+template <size_t INPUT_SIZE = INPUT_FIFO_SIZE,
+          size_t OUTPUT_SIZE = OUTPUT_FIFO_SIZE,
+          uint8_t MEASUREMENT_QUEUE_SIZE = 0, class PINS = GeminiRuntimePins>
+class GeminiK197ControlT
+    : public GeminiFrameT<INPUT_SIZE, OUTPUT_SIZE, PINS>,
+      public GeminiK197Types {
+  typedef GeminiFrameT<INPUT_SIZE, OUTPUT_SIZE, PINS>
+      GeminiFrame; ///< the frame layer (base class)
+
+public:
+  using GeminiFrame::frameComplete;
+  using GeminiFrame::getTiming;
+  using GeminiFrame::hasData;
+  using GeminiFrame::hasDeadline;
+  using GeminiFrame::isFrameEndDetected;
+  using GeminiFrame::nextDeadlineMicros;
+  using GeminiFrame::noOutputPending;
+  using GeminiFrame::pulse;
+  using GeminiFrame::waitPulseEnd;
+  using GeminiFrame::resetFrame;
+  using GeminiFrame::send;
+  using GeminiFrame::setInitiatorMode;
+  using GeminiFrame::setTiming;
+  using GeminiFrame::waitInputEdge;
+  using GeminiFrame::waitInputIdle;
+
+  /*!
+      @brief  constructor for the class.
+
+      @details See protocol specification for more information about the
+     protocol and its timing
+
+      @param inputPin input pin. Must be able to detect an edge interrupt (on a
+     UNO, only pin 2 and 3 can be used)
+      @param outputPin output pin. any I/O pin can be used
+      @param writePulseMicros minimum duration of the write pulse
+      @param handshakeTimeoutMicros timeout for handshakes. If no handshake
+     received the transmission is aborted (0 = no timeout)
+      @param readDelayMicros delay from the time an edge is detected on the
+     input pin, to the time the bit value is read
+      @param writeDelayMicros minimum time when writing. After an edge is
+     detected on the input pin (signaling the other peer has read the value on
+     the output pin), wait at least writeDelayMicros before returning the
+     outpout pin to LOW
+  */
+  GeminiK197ControlT(uint8_t inputPin, uint8_t outputPin,
+                     unsigned long writePulseMicros,
+                     unsigned long handshakeTimeoutMicros,
+                     unsigned long readDelayMicros,
+                     unsigned long writeDelayMicros)
+      : GeminiFrame(inputPin, outputPin, writePulseMicros,
+                    handshakeTimeoutMicros, readDelayMicros, writeDelayMicros) {
+
+  }
+
+  /*!
+      @brief  constructor for the class, with pins defined at compile time
+
+      @details only available when the pins are template parameters (e.g.
+     GeminiFixedPins), see GeminiProtocolT.
+
+      @param writePulseMicros minimum duration of the write pulse
+      @param handshakeTimeoutMicros timeout for handshakes. If no handshake
+     received the transmission is aborted (0 = no timeout)
+      @param readDelayMicros delay from the time an edge is detected on the
+     input pin, to the time the bit value is read
+      @param writeDelayMicros minimum time when writing. After an edge is
+     detected on the input pin (signaling the other peer has read the value on
+     the output pin), wait at least writeDelayMicros before returning the
+     outpout pin to LOW
+  */
+  GeminiK197ControlT(unsigned long writePulseMicros,
+                     unsigned long handshakeTimeoutMicros,
+                     unsigned long readDelayMicros,
+                     unsigned long writeDelayMicros)
+      : GeminiFrame(writePulseMicros, handshakeTimeoutMicros, readDelayMicros,
+                    writeDelayMicros) {}
+
 public:
   bool begin();
   bool begin(K197measurement *newInputBuffer);
@@ -496,13 +676,205 @@ public:
      protocol may time-out and abort the current frame transmission
   */
   void update() {
+    if (idleSleep) {
+      sleepWhileIdle();
+    }
     if (outputQueued && isFrameEndDetected() && noOutputPending()) {
       sendImmediately();
       outputQueued = false;
     }
     GeminiFrame::update();
+    if ((MEASUREMENT_QUEUE_SIZE > 0) && frameComplete() &&
+        (inputBuffer != NULL)) {
+      measurementQueue.push(*inputBuffer);
+      resetFrame();
+    }
+    if (calibrationParameter != CalibrationParameter::DONE) {
+      updateCalibration();
+    }
+  }
+
+  /*!
+      @brief  check if update() must be called now
+
+      @details in addition to the frame layer (see
+     GeminiFrameT::needsService()), update() must be called when a control
+     frame queued with execute() can be sent, or when a complete measurement
+     must be moved to the measurement queue. Use nextDeadlineMicros() to know
+     when update() must be called next. For example:
+
+      if (k197.needsService()) k197.update(); else doSomethingElse();
+      @return true if update() must be called now, false otherwise
+  */
+  bool needsService() {
+    if (GeminiFrame::needsService()) {
+      return true;
+    }
+    if (outputQueued && isFrameEndDetected() && noOutputPending()) {
+      return true;
+    }
+    return (MEASUREMENT_QUEUE_SIZE > 0) && frameComplete() &&
+           (inputBuffer != NULL);
   }
 
+  /*!
+      @brief  enable or disable the idle sleep mode
+      @details when enabled, update() puts the MCU to sleep if there is
+     nothing to do until the next edge from the K197: no deadline pending (see
+     hasDeadline()), no control frame queued or being sent and needsService()
+     returning false. This is normally the case between two frames (about 300
+     ms at 3 readings per second).
+
+      The MCU is woken by any interrupt: the edge interrupt of the input pin
+     records the time of the edge, so the first bit of the next frame is read
+     readDelayMicros after the edge as usual. On AVR the IDLE sleep mode is
+     used (see GeminiHal::sleepIdle()), the Timer0 interrupt wakes the MCU
+     every 1024 us so update() returns and loop() keeps running, but at a
+     much lower duty cycle.
+
+      The application should call update() once per loop() iteration, after
+     handling the measurement received (if any), so that sleeping does not
+     delay it.
+      @param enable true to enable the idle sleep mode, false to disable it
+  */
+  void setIdleSleep(bool enable = true) { idleSleep = enable; };
+  /*!
+      @brief  check if the idle sleep mode is enabled
+      @return true if the idle sleep mode is enabled
+  */
+  bool isIdleSleep() const { return idleSleep; };
+  /*!
+      @brief  get the number of times update() has put the MCU to sleep
+      @return the value of the idle sleep counter
+  */
+  unsigned long getIdleSleepCounter() const { return idleSleepCounter; };
+  /*!
+      @brief  reset the idle sleep counter
+  */
+  void resetIdleSleepCounter() { idleSleepCounter = 0L; };
+
+  /*!
+      @brief  start the calibration of the timing parameters
+      @details the values passed to the constructor (e.g. 10, 170 and 90
+     microseconds, as measured on the IEEE-488 card) are known to work, but
+     most of a frame is spent waiting for them. The calibration looks for a
+     faster set that works with the connected K197, while update() keeps
+     receiving frames as usual:
+      - writePulseMicros, then readDelayMicros, then writeDelayMicros are
+     stepped down, one at a time. A new value is applied at the end of a frame
+     (see GeminiProtocolT::setTiming()), starting with a step of half the
+     current value. The first step is also applied at the end of the frame
+     being received when this function is called
+      - if framesPerStep frames are received without errors, the new value is
+     stable and the next step is tried. The errors counted are protocol
+     errors, handshake timeouts, frame resyncs, frame timeouts, frame
+     overflows (see getFrameOverflowCounter()) and frames ending with a
+     partial sub-frame; the counters must not be reset during the calibration
+      - at the first error, the last stable value is restored and the step is
+     halved. When the step reaches 0 (or the value reaches
+     K197_CALIBRATION_MIN_MICROS, or the limits of setTiming()) the fastest
+     stable value is increased by a margin (K197_CALIBRATION_MARGIN_PERCENT,
+     at least K197_CALIBRATION_MARGIN_MICROS, but not above the initial
+     value) and the next parameter is calibrated
+
+      When isCalibrating() returns false the calibrated set is in use, and can
+     be retrieved with getTiming() (e.g. to store it in EEPROM and restore it
+     with setTiming() at startup, without calibrating again).
+
+      The measurements received during the calibration may be corrupted and
+     should be discarded. The K197 must be sending frames (measurements or
+     empty frames while waiting for a trigger). Only control frames exercise
+     the write delay with 1 bits, so control frames should be sent with
+     execute() during the calibration if the fastest write delay is wanted,
+     otherwise it is only calibrated with 0 bits.
+      @param framesPerStep number of frames without errors to accept a step
+  */
+  void startCalibration(uint8_t framesPerStep = K197_CALIBRATION_FRAMES) {
+    initialTiming = getTiming();
+    stableTiming = initialTiming;
+    calibrationFrames = framesPerStep > 0 ? framesPerStep : 1;
+    calibrationSteps = 0;
+    calibrationFailures = 0;
+    calibrationParameter = CalibrationParameter::WRITE_PULSE;
+    calibrationDecrement = stableTiming.writePulseMicros / 2;
+    calibrationPending = true; // applied by updateCalibration()
+  };
+  /*!
+      @brief  stop the calibration
+      @details the stable set found so far is used, with the margin added to
+     the parameter being calibrated
+  */
+  void stopCalibration() {
+    if (calibrationParameter != CalibrationParameter::DONE) {
+      addCalibrationMargin();
+      calibrationParameter = CalibrationParameter::DONE;
+      calibrationPending = false;
+      setTiming(stableTiming);
+    }
+  };
+  /*!
+      @brief  check if the calibration is in progress
+      @return true from startCalibration() until the calibrated set is in use
+     (or stopCalibration() is called)
+  */
+  bool isCalibrating() const {
+    return calibrationParameter != CalibrationParameter::DONE;
+  };
+  /*!
+      @brief  get the number of timing steps tried by the last calibration
+      @return the number of sets of timing parameters tried
+  */
+  uint8_t getCalibrationSteps() const { return calibrationSteps; };
+  /*!
+      @brief  get the number of timing steps rejected by the last calibration
+      @return the number of sets of timing parameters that showed errors
+  */
+  uint8_t getCalibrationFailures() const { return calibrationFailures; };
+
+  /*!
+      @brief get the oldest measurement in the measurement queue
+      @details only available when the measurement queue is enabled (template
+     parameter MEASUREMENT_QUEUE_SIZE greater than 0)
+      @param measurement pointer to a measurement where to copy the oldest
+     measurement received
+      @return true if a measurement was copied, false otherwise (queue empty)
+  */
+  bool popMeasurement(K197measurement *measurement) {
+    return measurementQueue.pull(measurement);
+  };
+  /*!
+      @brief get the number of measurements in the measurement queue
+      @return the number of measurements that can be retrieved with
+     popMeasurement()
+  */
+  uint8_t measurementsAvailable() const { return measurementQueue.size(); };
+  /*!
+      @brief check if a measurement overrun has been detected
+      @details an overrun is detected when a measurement is received but the
+     measurement queue is full. The measurement is lost in such a case. This
+     flag is reset when the function resetMeasurementOverrunCounter() is called
+      @return true if an overrun was detected, false otherwise
+  */
+  bool measurementOverrunDetected() const {
+    return measurementQueue.overruns > 0 ? true : false;
+  };
+  /*!
+      @brief get the measurement overrun counter
+      @details the counter is incremented any time a measurement is lost
+     because the measurement queue is full. The counter is reset when the
+     function resetMeasurementOverrunCounter() is called
+      @return the value of the measurement overrun counter
+  */
+  unsigned long getMeasurementOverrunCounter() const {
+    return measurementQueue.overruns;
+  };
+  /*!
+      @brief reset the measurement overrun counter
+      @details For more information see measurementOverrunDetected() and
+     getMeasurementOverrunCounter()
+  */
+  void resetMeasurementOverrunCounter() { measurementQueue.overruns = 0L; };
+
   /*!
       @brief get the current measurement buffer
       @return a pointer to the current meaasurement buffer
@@ -625,14 +997,324 @@ public:
   bool serverStartup(unsigned long timeout_micros);
 
 private:
+  /*!
+      @brief  private function, sleep until the next interrupt when idle
+      @details called by update() in idle sleep mode, it is not intended for
+     any other use. The conditions are checked with interrupts disabled, so
+     that an edge detected in the meantime is not missed (see
+     GeminiHal::sleepIdle())
+  */
+  void sleepWhileIdle() {
+    GeminiHal::disableInterrupts();
+    if (!outputQueued && noOutputPending() && !hasDeadline() &&
+        !needsService()) {
+      idleSleepCounter++;
+      GeminiHal::sleepIdle(); // returns with interrupts enabled
+    } else {
+      GeminiHal::enableInterrupts();
+    }
+  }
+
+  /*!
+      @brief  the timing parameter being calibrated
+  */
+  enum class CalibrationParameter : uint8_t {
+    WRITE_PULSE = 0, ///< writePulseMicros
+    READ_DELAY = 1,  ///< readDelayMicros
+    WRITE_DELAY = 2, ///< writeDelayMicros (not below writePulseMicros)
+    DONE = 3,        ///< the calibration is not running
+  };
+
+  /*!
+      @brief  private function, get a parameter of a timing set
+      @param timing the timing set
+      @param parameter the parameter (not DONE)
+      @return a reference to the parameter in timing
+  */
+  static unsigned long &timingValue(GeminiTiming &timing,
+                                    CalibrationParameter parameter) {
+    switch (parameter) {
+    case CalibrationParameter::READ_DELAY:
+      return timing.readDelayMicros;
+    case CalibrationParameter::WRITE_DELAY:
+      return timing.writeDelayMicros;
+    default:
+      return timing.writePulseMicros;
+    }
+  }
+
+  /*!
+      @brief  private function, get the sum of the error counters
+      @return the errors checked by the calibration
+  */
+  unsigned long calibrationErrorCount() {
+    return this->getProtocolErrorCounter() +
+           this->getHandshakeTimeoutCounter() +
+           this->getFrameResyncCounter() + this->getFrameTimeoutCounter() +
+           this->getFrameOverflowCounter();
+  }
+
+  /*!
+      @brief  private function, add the margin to the fastest stable value of
+     the parameter being calibrated
+      @details the value is increased by K197_CALIBRATION_MARGIN_PERCENT (at
+     least K197_CALIBRATION_MARGIN_MICROS), but not above the value at the
+     start of the calibration
+  */
+  void addCalibrationMargin() {
+    unsigned long &value = timingValue(stableTiming, calibrationParameter);
+    unsigned long limit = timingValue(initialTiming, calibrationParameter);
+    unsigned long margin = value * K197_CALIBRATION_MARGIN_PERCENT / 100;
+    if (margin < K197_CALIBRATION_MARGIN_MICROS) {
+      margin = K197_CALIBRATION_MARGIN_MICROS;
+    }
+    value = value + margin < limit ? value + margin : limit;
+  }
+
+  /*!
+      @brief  private function, apply the next set of timing parameters
+      @details the next value of the current parameter is the stable value
+     minus calibrationDecrement. When there is no next value, the calibration
+     moves to the next parameter, until the stable set is applied at the end
+  */
+  void nextCalibrationStep() {
+    while (calibrationParameter != CalibrationParameter::DONE) {
+      unsigned long value = timingValue(stableTiming, calibrationParameter);
+      unsigned long margin = value > K197_CALIBRATION_MIN_MICROS
+                                 ? value - K197_CALIBRATION_MIN_MICROS
+                                 : 0;
+      if (calibrationDecrement > margin) {
+        calibrationDecrement = margin;
+      }
+      if (calibrationDecrement > 0) {
+        GeminiTiming timing = stableTiming;
+        timingValue(timing, calibrationParameter) = value - calibrationDecrement;
+        setTiming(timing);
+        timing = getTiming(); // setTiming() may clamp the new value
+        if (timingValue(timing, calibrationParameter) < value) {
+          calibrationSteps++;
+          calibrationGoodFrames = 0;
+          calibrationErrors = calibrationErrorCount();
+          return;
+        }
+      }
+      addCalibrationMargin();
+      calibrationParameter =
+          (CalibrationParameter)((uint8_t)calibrationParameter + 1);
+      if (calibrationParameter != CalibrationParameter::DONE) {
+        calibrationDecrement =
+            timingValue(stableTiming, calibrationParameter) / 2;
+      }
+    }
+    setTiming(stableTiming);
+  }
+
+  /*!
+      @brief  private function, check the frames received during the
+     calibration
+      @details called by update() at every call while calibrating, it is not
+     intended for any other use. At the end of each frame the current set is
+     accepted (after calibrationFrames frames without errors) or rejected
+  */
+  void updateCalibration() {
+    bool frameEnd = isFrameEndDetected();
+    if (frameEnd && !calibrationFrameEnd && calibrationPending) {
+      // first step: the frame just ended was received with the initial set
+      calibrationPending = false;
+      nextCalibrationStep();
+    } else if (frameEnd && !calibrationFrameEnd) { // a frame has just ended
+      // a K197 frame ends after the last sub-frame (or with no sub-frames):
+      // a partial sub-frame means that some bits have been read incorrectly
+      bool partial = (this->frameStarted() && !frameComplete()) || hasData();
+      if (partial || (calibrationErrorCount() != calibrationErrors)) {
+        // back off
+        calibrationFailures++;
+        calibrationDecrement /= 2;
+        nextCalibrationStep();
+      } else if (++calibrationGoodFrames >= calibrationFrames) { // stable
+        stableTiming = getTiming();
+        nextCalibrationStep();
+      }
+    }
+    calibrationFrameEnd = frameEnd;
+  }
+
   K197measurement *inputBuffer = NULL; ///< stored received measurement results
   K197control *outputBuffer = NULL;    ///< store control commands to be sent
+  K197measurementQueue<MEASUREMENT_QUEUE_SIZE>
+      measurementQueue; ///< received measurements not yet retrieved
 
 protected:
   using GeminiFrame::begin;
   using GeminiFrame::sendFrame;
+  using GeminiFrame::setInputBuffer;
   bool outputQueued =
       false; ///< flag that outputBuffer shall be sent as soon as possible
+  bool idleSleep = false; ///< true when the idle sleep mode is enabled
+  unsigned long idleSleepCounter = 0; ///< count the calls to sleepIdle()
+
+  CalibrationParameter calibrationParameter =
+      CalibrationParameter::DONE; ///< the parameter being calibrated
+  GeminiTiming initialTiming =
+      GeminiTiming(); ///< timing set at the start of the calibration
+  GeminiTiming stableTiming =
+      GeminiTiming(); ///< fastest timing set without errors
+  unsigned long calibrationDecrement = 0; ///< current calibration step
+  unsigned long calibrationErrors = 0; ///< calibrationErrorCount() at the
+                                       ///< start of the current step
+  uint8_t calibrationFrames = K197_CALIBRATION_FRAMES; ///< frames per step
+  uint8_t calibrationGoodFrames = 0; ///< frames without errors in this step
+  uint8_t calibrationSteps = 0;      ///< timing sets tried
+  uint8_t calibrationFailures = 0;   ///< timing sets rejected
+  bool calibrationFrameEnd = true; ///< isFrameEndDetected() at the last update
+  bool calibrationPending =
+      false; ///< set by startCalibration(), the first step is applied at the
+             ///< next frame end
 };
 
+/*!
+    @brief K197 control handler with the default FIFO sizes
+*/
+typedef GeminiK197ControlT<> GeminiK197Control;
+
+#ifdef GEMINI_FIXED_PINS
+/*!
+      @brief GeminiK197ControlT with the default FIFO sizes and pins defined
+   at compile time (see GeminiFixedPins)
+      @tparam INPUT_PIN the input pin
+      @tparam OUTPUT_PIN the output pin
+      @tparam MEASUREMENT_QUEUE_SIZE number of slots in the measurement queue
+     (0 = no queue)
+*/
+template <uint8_t INPUT_PIN, uint8_t OUTPUT_PIN,
+          uint8_t MEASUREMENT_QUEUE_SIZE = 0>
+using GeminiK197FixedControl =
+    GeminiK197ControlT<INPUT_FIFO_SIZE, OUTPUT_FIFO_SIZE,
+                       MEASUREMENT_QUEUE_SIZE,
+                       GeminiFixedPins<INPUT_PIN, OUTPUT_PIN> >;
+#endif // GEMINI_FIXED_PINS
+
+/*!
+     @brief  initialize the object.
+
+     @details begin should be called before using the object
+
+     When begin is called without any argument, global default measurement
+   (input) and control (output) objects are used. Note that all instances of the
+   object will share the same global default objects
+
+     PREREQUISITES: Serial.begin must be called to see any error message
+
+     @return true if the call was succesful and the object can be used, false
+   otherwise
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE,
+          uint8_t MEASUREMENT_QUEUE_SIZE, class PINS>
+bool GeminiK197ControlT<INPUT_SIZE, OUTPUT_SIZE, MEASUREMENT_QUEUE_SIZE,
+                        PINS>::begin() {
+  return begin(&defaultMeasurementResult, &defaultControlRequest);
+}
+
+/*!
+     @brief  initialize the object.
+
+     @details begin should be called before using the object
+
+     When begin is called with a single argument, NO control (output) buffer is
+   assigned. This can be useful in case the object is only used for retrieving
+   measurement result. Alternatively, a control buffer can be set with
+   setControlBuffer(), or the application can include a control object directly
+   in sendImmediately.
+
+     @param newInputBuffer pointer to a measurement (input) buffer to receive
+   measurement results
+     @return true if the call was succesful and the object can be used, false
+   otherwise
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE,
+          uint8_t MEASUREMENT_QUEUE_SIZE, class PINS>
+bool GeminiK197ControlT<INPUT_SIZE, OUTPUT_SIZE, MEASUREMENT_QUEUE_SIZE,
+                        PINS>::begin(
+    K197measurement *newInputBuffer) {
+  setControlBuffer(NULL, false);
+  inputBuffer = newInputBuffer;
+  return GeminiFrame::begin((uint8_t *)inputBuffer,
+                            sizeof(K197measurement) / sizeof(uint8_t));
+}
+
+/*!
+     @brief  initialize the object.
+
+     @details begin should be called before using the object
+
+     When begin is called with two arguments, it is possible to use
+   sendImmediately() without arguments and/or execute() to send a control frame
+   to the K197. The application can also include a different control object
+   directly in sendImmediately.
+
+     @param newInputBuffer pointer to a measurement (input) buffer to receive
+   measurement results
+     @param newOutputBuffer pointer to a control (output) buffer that will be
+   used as default for this object
+     @return true if the call was succesful and the object can be used, false
+   otherwise
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE,
+          uint8_t MEASUREMENT_QUEUE_SIZE, class PINS>
+bool GeminiK197ControlT<INPUT_SIZE, OUTPUT_SIZE, MEASUREMENT_QUEUE_SIZE,
+                        PINS>::begin(
+    K197measurement *newInputBuffer, K197control *newOutputBuffer) {
+  setControlBuffer(newOutputBuffer, true);
+  inputBuffer = newInputBuffer;
+  return GeminiFrame::begin((uint8_t *)inputBuffer,
+                            sizeof(K197measurement) / sizeof(uint8_t));
+}
+
+/*!
+     @brief  simulate startup handshake from a real 488 card
+     @details this function will wait for a startup pulse from the K197 and then
+     try to simulate the startup handshake observed with a real 488 card
+     In the limited tests done (only one instrument tested), it is not required.
+     It is provided in case it may be required (e.g. due to different firmware
+   revision)
+     @param timeout_micros how much to wait for the startup pulse from K197
+   (timeout_micros=0 means wait forever)
+     @return true if the handshake was succesful, false otherwise
+*/
+template <size_t INPUT_SIZE, size_t OUTPUT_SIZE,
+          uint8_t MEASUREMENT_QUEUE_SIZE, class PINS>
+bool GeminiK197ControlT<INPUT_SIZE, OUTPUT_SIZE, MEASUREMENT_QUEUE_SIZE,
+                        PINS>::serverStartup(
+    unsigned long timeout_micros) {
+  if (timeout_micros != 0) {
+    if (!waitInputEdge(timeout_micros)) {
+      return false;
+    }
+  } else {
+    waitInputEdge();
+  }
+  pulse(1684);
+  waitPulseEnd();
+  GeminiHal::delayMicros(60);
+  pulse(20);
+  waitPulseEnd();
+
+  if (!waitInputIdle(50000UL)) {
+    return false;
+  }
+  GeminiHal::delayMillis(35);
+
+  uint8_t initial_data = 0x80;
+  send(initial_data);
+  send(false);
+
+  while (hasData(9) == false)
+    update();
+  // delayMicroseconds(100);
+  pulse(30);
+  waitPulseEnd();
+  setInitiatorMode(false);
+  return true;
+}
+
 #endif // K197CTRL_GEMINI_K197_CONTROL_H
@@ -0,0 +1,246 @@
+/**************************************************************************/
+/*!
+  @file     geminiPins.h
+
+  Arduino K197Control library
+
+  Copyright (C) 2023 by ALX2009
+
+  License: MIT (see LICENSE)
+
+  This file is part of the Arduino K197Display sketch, please see
+  https://github.com/alx2009/K197Control for more information
+
+  This file defines the pin I/O classes used by the gemini protocol
+  GeminiRuntimePins resolves the pins at run time (any board, or the host)
+  GeminiFixedPins resolves the pins at compile time (UNO and compatible)
+
+*/
+/**************************************************************************/
+#ifndef K197CTRL_GEMINI_PINS_H
+#define K197CTRL_GEMINI_PINS_H
+
+#include "geminiHal.h"
+
+#ifdef ARDUINO
+
+/*!
+      @brief pin I/O for the gemini protocol, with pins defined at run time
+
+      @details the AVR port registers and bitmasks are computed in the
+   constructor from the Arduino pin numbers. This works with any pin on any
+   board, but each access has to load the register address and the bitmask,
+   and write() is a non-atomic read-modify-write on the port register.
+
+      This is the default pin I/O class used by GeminiProtocolT.
+*/
+class GeminiRuntimePins {
+public:
+  /*!
+      @brief  constructor for the class
+      @param inputPin input pin
+      @param outputPin output pin
+  */
+  GeminiRuntimePins(uint8_t inputPin, uint8_t outputPin) {
+    inputBitmask = digitalPinToBitMask(inputPin);
+    outputBitmask = digitalPinToBitMask(outputPin);
+    uint8_t inputPort = digitalPinToPort(inputPin);
+    uint8_t outputPort = digitalPinToPort(outputPin);
+    inputRegister = portInputRegister(inputPort);
+    outputRegister = portOutputRegister(outputPort);
+  };
+
+  /*!
+    @brief  read the input pin using AVR registers directly
+    @return true if the input pin is high, false otherwise
+   */
+  inline bool read() const {
+    return (*inputRegister & inputBitmask) != 0 ? true : false;
+  };
+  /*!
+    @brief  write to the output pin using AVR registers directly
+    @param value if true the output pin is set to HIGH, otherwise LOW
+   */
+  inline void write(bool value) {
+    if (value) {
+      *outputRegister |= outputBitmask;
+    } else {
+      *outputRegister &= ~outputBitmask;
+    }
+  };
+  /*!
+    @brief  read back the level of the output pin (used by the trace)
+    @return true if the output pin is high, false otherwise
+   */
+  inline bool readOutput() const {
+    return (*outputRegister & outputBitmask) != 0 ? true : false;
+  };
+
+  /*!
+    @brief  get the AVR register of the output pin
+    @return the address of the port register
+   */
+  inline volatile uint8_t *getOutputRegister() const {
+    return outputRegister;
+  };
+  /*!
+    @brief  get the bitmask of the output pin
+    @return the bitmask of the output pin in the port register
+   */
+  inline uint8_t getOutputBitmask() const { return outputBitmask; };
+
+private:
+  uint8_t inputBitmask = 0x00;  ///< bitmask used by read()
+  uint8_t outputBitmask = 0x00; ///< bitmask used by write()
+  volatile uint8_t *inputRegister =
+      NULL; ///< AVR register address used by read()
+  volatile uint8_t *outputRegister =
+      NULL; ///< AVR register address used by write()
+};
+
+#else // host implementation
+
+/*!
+      @brief pin I/O for the gemini protocol, with pins defined at run time
+
+      @details host version, the pins are simulated by GeminiHal (see
+   GeminiHal::readPin() and GeminiHal::writePin())
+
+      This is the default pin I/O class used by GeminiProtocolT.
+*/
+class GeminiRuntimePins {
+public:
+  /*!
+      @brief  constructor for the class
+      @param inputPin input pin
+      @param outputPin output pin
+  */
+  GeminiRuntimePins(uint8_t inputPin, uint8_t outputPin)
+      : inputPin(inputPin), outputPin(outputPin){};
+
+  /*!
+    @brief  read the input pin
+    @return true if the input pin is high, false otherwise
+   */
+  inline bool read() const { return GeminiHal::readPin(inputPin); };
+  /*!
+    @brief  write to the output pin
+    @param value if true the output pin is set to HIGH, otherwise LOW
+   */
+  inline void write(bool value) { GeminiHal::writePin(outputPin, value); };
+  /*!
+    @brief  read back the level of the output pin (used by the trace)
+    @return true if the output pin is high, false otherwise
+   */
+  inline bool readOutput() const { return GeminiHal::readPin(outputPin); };
+
+private:
+  uint8_t inputPin;  ///< input pin
+  uint8_t outputPin; ///< output pin
+};
+
+#endif // ARDUINO
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) ||               \
+    defined(__AVR_ATmega168__) || defined(__AVR_ATmega168P__)
+
+/*!
+ * @brief the input register of an Arduino UNO pin (must be a constant)
+ */
+#define GEMINI_PIN_INPUT_REG(pin)                                              \
+  ((pin) < 8 ? PIND : (pin) < 14 ? PINB : PINC)
+/*!
+ * @brief the output register of an Arduino UNO pin (must be a constant)
+ */
+#define GEMINI_PIN_OUTPUT_REG(pin)                                             \
+  ((pin) < 8 ? PORTD : (pin) < 14 ? PORTB : PORTC)
+/*!
+ * @brief the bitmask of an Arduino UNO pin (must be a constant)
+ */
+#define GEMINI_PIN_BITMASK(pin)                                                \
+  ((uint8_t)(1 << ((pin) < 8 ? (pin) : (pin) < 14 ? (pin)-8 : (pin)-14)))
+
+#define GEMINI_FIXED_PINS ///< defined when GeminiFixedPins is available
+
+/*!
+      @brief pin I/O for the gemini protocol, with pins defined at compile time
+
+      @details the AVR port registers and bitmasks are resolved at compile
+   time, so that read() and write() compile to single sbis/sbi/cbi
+   instructions. Since sbi and cbi are atomic, there is no read-modify-write
+   race with interrupt handlers writing to other pins of the same port.
+
+      Only available for the ATmega328P/168 (Arduino UNO, Nano, etc.), where
+   the pins 0-19 are mapped to PORTD, PORTB and PORTC.
+
+      Use as the PINS template parameter, or more simply with the aliases
+   GeminiFixedProtocol<2, 3>, GeminiFixedFrame<2, 3> and
+   GeminiK197FixedControl<2, 3>. The gemini objects are then constructed
+   without pin arguments: the pins are only given as template arguments, so
+   they cannot differ from the ones used for the edge interrupt.
+
+      @tparam INPUT_PIN the input pin
+      @tparam OUTPUT_PIN the output pin
+*/
+template <uint8_t INPUT_PIN, uint8_t OUTPUT_PIN> class GeminiFixedPins {
+  static_assert(INPUT_PIN < 20 && OUTPUT_PIN < 20,
+                "GeminiFixedPins only supports pins 0 to 19");
+
+public:
+  static const uint8_t fixedInputPin = INPUT_PIN;   ///< the input pin
+  static const uint8_t fixedOutputPin = OUTPUT_PIN; ///< the output pin
+
+  /*!
+      @brief  constructor for the class
+      @details the pins are template parameters (see the GeminiProtocolT
+     constructor without pin arguments)
+  */
+  GeminiFixedPins(){};
+
+  /*!
+    @brief  read the input pin
+    @return true if the input pin is high, false otherwise
+   */
+  inline bool read() const {
+    return (GEMINI_PIN_INPUT_REG(INPUT_PIN) & GEMINI_PIN_BITMASK(INPUT_PIN)) !=
+           0;
+  };
+  /*!
+    @brief  write to the output pin
+    @param value if true the output pin is set to HIGH, otherwise LOW
+   */
+  inline void write(bool value) {
+    if (value) {
+      GEMINI_PIN_OUTPUT_REG(OUTPUT_PIN) |= GEMINI_PIN_BITMASK(OUTPUT_PIN);
+    } else {
+      GEMINI_PIN_OUTPUT_REG(OUTPUT_PIN) &= ~GEMINI_PIN_BITMASK(OUTPUT_PIN);
+    }
+  };
+  /*!
+    @brief  read back the level of the output pin (used by the trace)
+    @return true if the output pin is high, false otherwise
+   */
+  inline bool readOutput() const {
+    return (GEMINI_PIN_OUTPUT_REG(OUTPUT_PIN) &
+            GEMINI_PIN_BITMASK(OUTPUT_PIN)) != 0;
+  };
+
+  /*!
+    @brief  get the AVR register of the output pin
+    @return the address of the port register
+   */
+  inline volatile uint8_t *getOutputRegister() const {
+    return &GEMINI_PIN_OUTPUT_REG(OUTPUT_PIN);
+  };
+  /*!
+    @brief  get the bitmask of the output pin
+    @return the bitmask of the output pin in the port register
+   */
+  inline uint8_t getOutputBitmask() const {
+    return GEMINI_PIN_BITMASK(OUTPUT_PIN);
+  };
+};
+
+#endif // __AVR_ATmega328P__ ...
+
+#endif // K197CTRL_GEMINI_PINS_H
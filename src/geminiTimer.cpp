@@ -0,0 +1,125 @@
+/**************************************************************************/
+/*!
+  @file     geminiTimer.cpp
+
+  Arduino K197Control library sketch
+
+  Copyright (C) 2023 by ALX2009
+
+  License: MIT (see LICENSE)
+
+  This file is part of the Arduino K197control library, please see
+  https://github.com/alx2009/K197Control for more information
+
+  Note: this file implements the class GeminiTimer and the Timer1 interrupt
+  handlers
+*/
+#include "geminiTimer.h"
+
+#ifdef GEMINI_USE_TIMER1
+
+volatile GeminiTimer::Callback GeminiTimer::compareACallback = NULL;
+void *volatile GeminiTimer::compareAContext = NULL;
+volatile GeminiTimer::CaptureCallback GeminiTimer::captureCallback = NULL;
+void *volatile GeminiTimer::captureContext = NULL;
+volatile uint8_t *volatile GeminiTimer::pulseRegister = NULL;
+volatile uint8_t GeminiTimer::pulseBitmask = 0x00;
+volatile bool GeminiTimer::pulseFinalState = false;
+
+/*!
+     @brief  initialize Timer1
+
+     @details Timer1 is configured in normal mode (free running), with a
+   prescaler of GEMINI_TIMER_PRESCALER. All the Timer1 interrupts are disabled
+   until an event is scheduled. Only the first call initializes the timer, so
+   that more than one gemini object can call begin()
+*/
+void GeminiTimer::begin() {
+  static bool started = false;
+  if (started) {
+    return;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+  TIMSK1 = 0;
+  TCCR1A = 0;
+#if GEMINI_TIMER_PRESCALER == 8
+  TCCR1B = _BV(CS11);
+#elif GEMINI_TIMER_PRESCALER == 1
+  TCCR1B = _BV(CS10);
+#else
+#error "unsupported GEMINI_TIMER_PRESCALER"
+#endif
+  TIFR1 = 0xff; // clear all pending interrupt flags
+  started = true;
+  SREG = oldSREG;
+}
+
+/*!
+     @brief  enable the input capture interrupt
+
+     @details the capture unit is configured to detect the rising edge on the
+   ICP1 pin, with the noise canceler enabled (the edge must be stable for 4
+   clock cycles). The callback is called in interrupt context for each edge,
+   with the captured Timer1 count.
+     @param callback the function called when an edge is captured
+     @param context a pointer that will be passed to the callback
+*/
+void GeminiTimer::attachCapture(CaptureCallback callback, void *context) {
+  uint8_t oldSREG = SREG;
+  cli();
+  captureCallback = callback;
+  captureContext = context;
+  TCCR1B |= _BV(ICNC1) | _BV(ICES1);
+  TIFR1 = _BV(ICF1); // clear any pending capture
+  TIMSK1 |= _BV(ICIE1);
+  SREG = oldSREG;
+}
+
+/*!
+     @brief  disable the input capture interrupt
+*/
+void GeminiTimer::detachCapture() {
+  uint8_t oldSREG = SREG;
+  cli();
+  TIMSK1 &= ~_BV(ICIE1);
+  captureCallback = NULL;
+  captureContext = NULL;
+  SREG = oldSREG;
+}
+
+/*!
+     @brief  Timer1 compare A interrupt handler.
+
+     @details the compare A event is one shot, so the interrupt is disabled
+   before calling the callback (which can schedule a new event if needed)
+*/
+ISR(TIMER1_COMPA_vect) {
+  TIMSK1 &= ~_BV(OCIE1A);
+  GeminiTimer::Callback callback = GeminiTimer::compareACallback;
+  if (callback != NULL) {
+    callback(GeminiTimer::compareAContext);
+  }
+}
+
+/*!
+     @brief  Timer1 compare B interrupt handler.
+
+     @details terminates the pulse started with GeminiTimer::startPulse()
+*/
+ISR(TIMER1_COMPB_vect) { GeminiTimer::endPulse(); }
+
+/*!
+     @brief  Timer1 input capture interrupt handler.
+
+     @details calls the input capture callback with the captured timer count
+*/
+ISR(TIMER1_CAPT_vect) {
+  uint16_t ticks = ICR1;
+  GeminiTimer::CaptureCallback callback = GeminiTimer::captureCallback;
+  if (callback != NULL) {
+    callback(GeminiTimer::captureContext, ticks);
+  }
+}
+
+#endif // GEMINI_USE_TIMER1
@@ -0,0 +1,222 @@
+/**************************************************************************/
+/*!
+  @file     geminiTimer.h
+
+  Arduino K197Control library
+
+  Copyright (C) 2023 by ALX2009
+
+  License: MIT (see LICENSE)
+
+  This file is part of the Arduino K197Display sketch, please see
+  https://github.com/alx2009/K197Control for more information
+
+  This file defines the GeminiTimer class
+  The GeminiTimer class is used by the gemini protocol to schedule events in
+  interrupt context using the hardware Timer1
+
+*/
+/**************************************************************************/
+#ifndef K197CTRL_GEMINI_TIMER_H
+#define K197CTRL_GEMINI_TIMER_H
+
+#include "geminiHal.h"
+
+// uncomment the following definition to enable the features using Timer1
+// (interrupt driven mode). Note that when enabled, Timer1 cannot be used for
+// other purposes (e.g. analogWrite() on pin 9 and 10, the Servo library, etc.)
+//#define GEMINI_USE_TIMER1 ///< when defined, enable Timer1 based features
+
+#ifdef GEMINI_USE_TIMER1
+
+#if !defined(TCCR1A) || !defined(OCR1A) || !defined(TIMSK1)
+#error "GEMINI_USE_TIMER1 requires an AVR with a 16 bit Timer1"
+#endif
+
+#ifndef GEMINI_TIMER_PRESCALER
+#define GEMINI_TIMER_PRESCALER                                                 \
+  8 ///< Timer1 prescaler (8 or 1). With a prescaler of 1 the resolution is
+    ///< 62.5 ns at 16 MHz, but the maximum delay is about 4 milliseconds
+#endif
+#define GEMINI_TIMER_TICKS_PER_MICRO                                           \
+  (F_CPU / GEMINI_TIMER_PRESCALER /                                            \
+   1000000UL) ///< Timer1 ticks in one microsecond (2 at 16 MHz)
+#define GEMINI_TIMER_MIN_MICROS                                                \
+  8 ///< minimum delay in microseconds, shorter delays could miss the compare
+    ///< match
+#define GEMINI_TIMER_MIN_TICKS                                                 \
+  (GEMINI_TIMER_MIN_MICROS *                                                   \
+   GEMINI_TIMER_TICKS_PER_MICRO) ///< minimum delay in timer ticks
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) ||               \
+    defined(__AVR_ATmega168__) || defined(__AVR_ATmega168P__)
+#define GEMINI_ICP1_PIN 8 ///< the Arduino pin connected to ICP1 (input capture)
+#elif defined(__AVR_ATmega32U4__)
+#define GEMINI_ICP1_PIN 4 ///< the Arduino pin connected to ICP1 (input capture)
+#endif
+
+/*!
+      @brief gemini protocol timer
+
+      @details this class handles Timer1, which is configured in normal mode
+   (free running) with a prescaler of GEMINI_TIMER_PRESCALER. Compare unit A is
+   used to call a function in interrupt context after a given delay (one shot).
+   Compare unit B is used to generate pulses on an output pin without blocking
+   (see startPulse()). The input capture unit is used to timestamp the rising
+   edges on the ICP1 pin (GEMINI_ICP1_PIN, pin 8 on a UNO).
+
+      Only one callback can be attached at a time, i.e. only one gemini object
+   can use the interrupt driven mode.
+*/
+class GeminiTimer {
+public:
+  /*!
+      @brief  callback function, called in interrupt context
+      @param context the pointer passed when the callback was attached
+  */
+  typedef void (*Callback)(void *context);
+  /*!
+      @brief  input capture callback, called in interrupt context
+      @param context the pointer passed when the callback was attached
+      @param ticks the Timer1 count captured at the time of the edge
+  */
+  typedef void (*CaptureCallback)(void *context, uint16_t ticks);
+
+  static void begin();
+  static void attachCapture(CaptureCallback callback, void *context);
+  static void detachCapture();
+
+  /*!
+      @brief  convert Timer1 ticks to microseconds
+      @param ticks the time in timer ticks
+      @return the equivalent number of microseconds
+  */
+  static inline uint16_t ticksToMicros(uint16_t ticks) {
+    return ticks / GEMINI_TIMER_TICKS_PER_MICRO;
+  };
+
+  /*!
+      @brief  attach the callback for compare unit A
+      @param callback the function called when the compare match occurs
+      @param context a pointer that will be passed to the callback
+  */
+  static void attachCompareA(Callback callback, void *context) {
+    uint8_t oldSREG = SREG;
+    cli();
+    compareACallback = callback;
+    compareAContext = context;
+    SREG = oldSREG;
+  };
+
+  /*!
+      @brief  get the current Timer1 count
+      @return the current value of the Timer1 counter
+  */
+  static inline uint16_t now() { return TCNT1; };
+
+  /*!
+      @brief  convert microseconds to Timer1 ticks
+      @param micros the time in microseconds
+      @return the equivalent number of timer ticks (limited to 0xffff)
+  */
+  static inline uint16_t microsToTicks(unsigned long micros) {
+    return micros >= 0xffffUL / GEMINI_TIMER_TICKS_PER_MICRO
+               ? 0xffff
+               : (uint16_t)(micros * GEMINI_TIMER_TICKS_PER_MICRO);
+  };
+
+  /*!
+      @brief  schedule the compare A callback (one shot)
+      @details must be called with interrupts disabled (e.g. from an
+     interrupt handler). Any previously scheduled compare A event is replaced
+      @param start the timer count the delay is referred to (e.g. now())
+      @param delayTicks delay in timer ticks (at least GEMINI_TIMER_MIN_TICKS
+     from now)
+  */
+  static inline void scheduleCompareA(uint16_t start, uint16_t delayTicks) {
+    uint16_t at = start + delayTicks;
+    if ((uint16_t)(at - TCNT1) < GEMINI_TIMER_MIN_TICKS ||
+        (uint16_t)(at - TCNT1) > delayTicks) { // too late (or passed)
+      at = TCNT1 + GEMINI_TIMER_MIN_TICKS;
+    }
+    OCR1A = at;
+    TIFR1 = _BV(OCF1A); // clear any pending compare match
+    TIMSK1 |= _BV(OCIE1A);
+  };
+
+  /*!
+      @brief  cancel the compare A callback
+  */
+  static inline void cancelCompareA() { TIMSK1 &= ~_BV(OCIE1A); };
+
+  /*!
+      @brief  generate a pulse (or a positive edge) on an output pin
+      @details the pin is set HIGH immediately, then the compare B interrupt
+     sets it to finalState after delayTicks. The function returns immediately,
+     use pulseActive() to check if the pulse is still in progress. A pulse
+     still in progress is terminated (set to its final state) first.
+      @param outputRegister the AVR port register of the output pin
+      @param outputBitmask the bitmask of the output pin in outputRegister
+      @param finalState the state of the pin at the end of the pulse
+      @param delayTicks the duration of the pulse in timer ticks (at least
+     GEMINI_TIMER_MIN_TICKS)
+  */
+  static void startPulse(volatile uint8_t *outputRegister,
+                         uint8_t outputBitmask, bool finalState,
+                         uint16_t delayTicks) {
+    uint8_t oldSREG = SREG;
+    cli();
+    if (pulseActive()) {
+      endPulse();
+    }
+    *outputRegister |= outputBitmask;
+    pulseRegister = outputRegister;
+    pulseBitmask = outputBitmask;
+    pulseFinalState = finalState;
+    if (delayTicks < GEMINI_TIMER_MIN_TICKS) {
+      delayTicks = GEMINI_TIMER_MIN_TICKS;
+    }
+    OCR1B = TCNT1 + delayTicks;
+    TIFR1 = _BV(OCF1B); // clear any pending compare match
+    TIMSK1 |= _BV(OCIE1B);
+    SREG = oldSREG;
+  };
+
+  /*!
+      @brief  check if a pulse is in progress
+      @return true if a pulse started with startPulse() is in progress
+  */
+  static inline bool pulseActive() { return (TIMSK1 & _BV(OCIE1B)) != 0; };
+
+  /*!
+      @brief  cancel the pulse in progress, leaving the pin as it is
+  */
+  static inline void cancelPulse() { TIMSK1 &= ~_BV(OCIE1B); };
+
+  /*!
+      @brief  terminate the pulse in progress, setting the pin to its final
+     state
+      @details must be called with interrupts disabled (e.g. from an interrupt
+     handler). Used by the compare B interrupt handler
+  */
+  static inline void endPulse() {
+    TIMSK1 &= ~_BV(OCIE1B);
+    if (pulseFinalState) {
+      *pulseRegister |= pulseBitmask;
+    } else {
+      *pulseRegister &= ~pulseBitmask;
+    }
+  };
+
+  static volatile Callback compareACallback; ///< compare A callback
+  static void *volatile compareAContext;     ///< compare A callback context
+  static volatile CaptureCallback captureCallback; ///< input capture callback
+  static void *volatile captureContext; ///< input capture callback context
+  static volatile uint8_t *volatile pulseRegister; ///< pulse output register
+  static volatile uint8_t pulseBitmask;   ///< pulse output pin bitmask
+  static volatile bool pulseFinalState;   ///< pin state at the pulse end
+};
+
+#endif // GEMINI_USE_TIMER1
+
+#endif // K197CTRL_GEMINI_TIMER_H
@@ -0,0 +1,284 @@
+/**************************************************************************/
+/*!
+  @file     geminiTrace.h
+
+  Arduino K197Control library
+
+  Copyright (C) 2023 by ALX2009
+
+  License: MIT (see LICENSE)
+
+  This file is part of the Arduino K197Display sketch, please see
+  https://github.com/alx2009/K197Control for more information
+
+  This file defines the GeminiTraceT class
+  The GeminiTraceT class is a ring of compact records in RAM, logging every
+  state transition of the gemini protocol without affecting its timing. The
+  records can be dumped without blocking and decoded on a PC (see
+  extras/host/geminiTraceDecode.cpp)
+
+*/
+/**************************************************************************/
+#ifndef K197CTRL_GEMINI_TRACE_H
+#define K197CTRL_GEMINI_TRACE_H
+
+#include "geminiHal.h"
+
+// uncomment the following definition to enable the trace. Each record uses 4
+// bytes of RAM in each gemini object (power of two, from 8 to 128 records)
+//#define GEMINI_TRACE_SIZE 32 ///< when defined, number of trace records
+
+#define GEMINI_TRACE_INPUT 0x01  ///< levels: the input pin is HIGH
+#define GEMINI_TRACE_OUTPUT 0x02 ///< levels: the output pin is HIGH
+#define GEMINI_TRACE_BIT_READ                                                  \
+  0x04 ///< levels: the bit read (when leaving BIT_READ_START)
+#define GEMINI_TRACE_BIT_WRITTEN                                               \
+  0x08 ///< levels: the bit written (when entering BIT_WRITE_WAIT_ACK)
+#define GEMINI_TRACE_FRAME_END 0x10 ///< levels: frameEndDetected is set
+
+#define GEMINI_TRACE_LONG_DELTA                                                \
+  0x8000 ///< delta: when set, the delta is in units of 1024 microseconds
+#define GEMINI_TRACE_LINE_SIZE                                                 \
+  10 ///< buffer size for GeminiTraceRecord::format() (including the null)
+
+/*!
+      @brief a record of the trace (4 bytes)
+
+      @details delta is the time since the previous record: in microseconds up
+   to 32767 us, otherwise in units of 1024 us (GEMINI_TRACE_LONG_DELTA set).
+   The remainder of a long delta is carried over to the next record, so the
+   time does not drift. 0xffff means more than 33.5 seconds.
+
+      transition stores the old state (bits 0-1), the new state (bits 2-3) and
+   the event (bits 4-6). Bit 7 is set when records have been lost before this
+   one because the trace was full. levels stores the GEMINI_TRACE_* flags, as
+   they are right after the transition.
+*/
+struct GeminiTraceRecord {
+  /*!
+      @brief the events recorded
+  */
+  enum Event : uint8_t {
+    STATE = 0,         ///< protocol state change (GeminiProtocolT states)
+    FRAME_END = 1,     ///< frame end detected (frame timeout)
+    ABORT = 2,         ///< transfer aborted (timeout or protocol error)
+    FRAME_STATE = 3,   ///< frame layer state change (GeminiFrameT states)
+    FRAME_RESYNC = 4,  ///< partial frame discarded at a sync sequence
+    FRAME_TIMEOUT = 5, ///< partial frame discarded at the frame timeout
+  };
+
+  uint16_t delta;     ///< time since the previous record
+  uint8_t transition; ///< old state, new state, event and lost flag
+  uint8_t levels;     ///< pin levels and bit values (GEMINI_TRACE_* flags)
+
+  /*!
+      @brief  get the event
+      @return the event recorded
+  */
+  Event getEvent() const { return (Event)((transition >> 4) & 0x07); };
+  /*!
+      @brief  get the state before the transition
+      @return the old state
+  */
+  uint8_t getOldState() const { return transition & 0x03; };
+  /*!
+      @brief  get the state after the transition
+      @return the new state
+  */
+  uint8_t getNewState() const { return (transition >> 2) & 0x03; };
+  /*!
+      @brief  check if records have been lost before this one
+      @return true if the trace was full before this record
+  */
+  bool lostBefore() const { return (transition & 0x80) != 0; };
+  /*!
+      @brief  get the time since the previous record
+      @return the delta in microseconds
+  */
+  unsigned long getDeltaMicros() const {
+    return (delta & GEMINI_TRACE_LONG_DELTA)
+               ? (unsigned long)(delta & ~GEMINI_TRACE_LONG_DELTA) << 10
+               : delta;
+  };
+
+  /*!
+      @brief  format the record as a line of text: '~' and 8 hex digits
+     (delta, transition and levels)
+      @param buffer destination, at least GEMINI_TRACE_LINE_SIZE characters
+      @return buffer
+  */
+  char *format(char *buffer) const {
+    static const char hex[] = "0123456789abcdef";
+    uint32_t value = ((uint32_t)delta << 16) | ((uint16_t)transition << 8) |
+                     levels;
+    buffer[0] = '~';
+    for (uint8_t i = 0; i < 8; i++) {
+      buffer[8 - i] = hex[value & 0x0f];
+      value >>= 4;
+    }
+    buffer[9] = '\0';
+    return buffer;
+  };
+  /*!
+      @brief  parse a line formatted by format()
+      @param line the text to parse, starting with '~'
+      @return true if the record was parsed, false otherwise
+  */
+  bool parse(const char *line) {
+    if (line[0] != '~') {
+      return false;
+    }
+    uint32_t value = 0;
+    for (uint8_t i = 1; i <= 8; i++) {
+      char c = line[i];
+      uint8_t digit = (c >= '0' && c <= '9')   ? c - '0'
+                      : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                                               : 0xff;
+      if (digit == 0xff) {
+        return false;
+      }
+      value = (value << 4) | digit;
+    }
+    delta = (uint16_t)(value >> 16);
+    transition = (uint8_t)(value >> 8);
+    levels = (uint8_t)value;
+    return true;
+  };
+};
+
+/*!
+      @brief trace ring for the gemini protocol
+
+      @details log() stores a record with the time since the previous record.
+   It can be called in interrupt context. When the trace is full new records
+   are discarded (and counted), so that the records already stored keep a
+   consistent timeline; the next record stored is marked (see
+   GeminiTraceRecord::lostBefore()).
+
+      The records are retrieved with pull(), or printed with dump() without
+   blocking. Only the time of the transition is recorded, so the cost in the
+   protocol hot path is a call to micros() and 4 bytes stored.
+
+      @tparam N the number of records (power of two, from 8 to 128)
+*/
+template <uint8_t N> class GeminiTraceT {
+  static_assert(N >= 8 && N <= 128 && (N & (N - 1)) == 0,
+                "GeminiTraceT size must be a power of two, from 8 to 128");
+
+public:
+  static const uint8_t capacity = N; ///< the number of records
+
+  /*!
+      @brief  store a record
+      @param event the event (see GeminiTraceRecord::Event)
+      @param oldState the state before the transition
+      @param newState the state after the transition
+      @param levels the GEMINI_TRACE_* flags
+  */
+  void log(uint8_t event, uint8_t oldState, uint8_t newState, uint8_t levels) {
+    GEMINI_CRITICAL_SECTION() {
+      if ((uint8_t)(tail - head) >= N) {
+        lostCounter++;
+        lost = true;
+      } else {
+        unsigned long now = GeminiHal::micros();
+        unsigned long delta = now - lastTime;
+        GeminiTraceRecord &record = records[tail & (N - 1)];
+        if (delta < GEMINI_TRACE_LONG_DELTA) {
+          record.delta = (uint16_t)delta;
+          lastTime = now;
+        } else if ((delta >> 10) < GEMINI_TRACE_LONG_DELTA) {
+          record.delta = (uint16_t)(delta >> 10) | GEMINI_TRACE_LONG_DELTA;
+          lastTime += record.getDeltaMicros(); // carry the remainder over
+        } else { // saturated, the absolute time is lost
+          record.delta = 0xffff;
+          lastTime = now;
+        }
+        record.transition = (oldState & 0x03) | ((newState & 0x03) << 2) |
+                            ((event & 0x07) << 4) | (lost ? 0x80 : 0x00);
+        record.levels = levels;
+        lost = false;
+        tail++;
+      }
+    }
+  };
+
+  /*!
+      @brief  get the oldest record
+      @param record where to copy the record
+      @return true if a record was copied, false if the trace is empty
+  */
+  bool pull(GeminiTraceRecord &record) {
+    bool result = false;
+    GEMINI_CRITICAL_SECTION() {
+      if (tail != head) {
+        record = records[head & (N - 1)];
+        head++;
+        result = true;
+      }
+    }
+    return result;
+  };
+
+  /*!
+      @brief  get the number of records stored
+      @return the number of records that can be retrieved with pull()
+  */
+  uint8_t size() const {
+    uint8_t value = 0;
+    GEMINI_CRITICAL_SECTION() { value = tail - head; }
+    return value;
+  };
+  /*!
+      @brief  get the number of records lost because the trace was full
+      @return the value of the lost records counter
+  */
+  unsigned long getLostCounter() const {
+    unsigned long value = 0;
+    GEMINI_CRITICAL_SECTION() { value = lostCounter; }
+    return value;
+  };
+  /*!
+      @brief  discard all the records and reset the lost records counter
+  */
+  void clear() {
+    GEMINI_CRITICAL_SECTION() {
+      head = tail;
+      lostCounter = 0;
+      lost = false;
+    }
+  };
+
+#ifdef ARDUINO
+  /*!
+      @brief  print the records without blocking
+      @details records are printed one per line (see
+     GeminiTraceRecord::format()), only as long as they fit in the transmit
+     buffer of out, so this function can be called at every loop()
+     iteration. out must implement availableForWrite() (e.g. Serial)
+      @param out where to print
+      @return the number of records printed
+  */
+  uint8_t dump(Print &out) {
+    uint8_t count = 0;
+    char line[GEMINI_TRACE_LINE_SIZE];
+    GeminiTraceRecord record;
+    while ((out.availableForWrite() >= GEMINI_TRACE_LINE_SIZE + 1) &&
+           pull(record)) {
+      out.println(record.format(line));
+      count++;
+    }
+    return count;
+  };
+#endif // ARDUINO
+
+private:
+  GeminiTraceRecord records[N]; ///< the records
+  volatile uint8_t head = 0;   ///< next record to pull (free running)
+  volatile uint8_t tail = 0;   ///< next record to store (free running)
+  unsigned long lastTime = 0;  ///< time of the last record stored
+  bool lost = false;           ///< records lost since the last one stored
+  unsigned long lostCounter = 0; ///< records lost because the trace was full
+};
+
+#endif // K197CTRL_GEMINI_TRACE_H
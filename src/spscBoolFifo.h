@@ -0,0 +1,190 @@
+/**************************************************************************/
+/*!
+  @file     spscBoolFifo.h
+
+  Arduino K197Control library
+
+  Copyright (C) 2023 by ALX2009
+
+  License: MIT (see LICENSE)
+
+  This file is part of the Arduino K197Display sketch, please see
+  https://github.com/alx2009/K197Control for more information
+
+  This file defines a FIFO that can be shared between an interrupt handler
+  and the main loop
+
+*/
+/**************************************************************************/
+#ifndef K197CTRL_SPSC_BOOL_FIFO_H
+#define K197CTRL_SPSC_BOOL_FIFO_H
+
+/*!
+      @brief define a class implementing a lock-free, single producer single
+   consumer FIFO buffer
+
+      @details This class works like boolFifo, but it can be used to pass bits
+   between an interrupt handler and the main loop without disabling interrupts
+   (no ATOMIC_BLOCK is required).
+
+      The FIFO is safe as long as there is only one producer (calling push() or
+   pushBits()) and one consumer (calling pull(), pullBits() or flush()).
+   Either of them can run in interrupt context. The other functions can be
+   called by both.
+
+      This works because the producer is the only one updating the tail, the
+   consumer is the only one updating the head, and both indexes are single
+   byte volatile variables (read and written atomically by the AVR). The
+   producer always writes a bit before updating the tail, the consumer always
+   reads a bit before updating the head. The indexes are free running counters,
+   so the capacity N (in bits) must be a power of two between 8 and 128.
+
+      Bits are packed 8 per byte, starting from the MSB (same as boolFifo).
+
+      @tparam N the capacity of the FIFO in bits
+*/
+template <uint8_t N> class spscBoolFifo {
+  static_assert(N >= 8 && N <= 128 && (N & (N - 1)) == 0,
+                "spscBoolFifo size must be a power of two, from 8 to 128");
+
+public:
+  static const uint8_t capacity = N; ///< the capacity of the FIFO in bits
+
+  /*!
+      @brief  constructor for the class. After construction the FIFO is empty.
+  */
+  spscBoolFifo() : head(0), tail(0){};
+
+  /*!
+      @brief  store a new value in the FIFO if there is space left (producer)
+      @param value the value that should be pushed at the tail of the FIFO
+      @return true if the value was stored correctly, false otherwise (FIFO
+     full)
+  */
+  bool push(bool value) {
+    uint8_t t = tail;
+    if ((uint8_t)(t - head) >= N) {
+      return false; // FIFO is full
+    }
+    writeBit(t, value);
+    tail = t + 1;
+    return true;
+  };
+
+  /*!
+      @brief  store up to 32 bits in the FIFO if there is space left
+     (producer)
+      @details same as boolFifo::pushBits()
+      @param value the bits that should be pushed at the tail of the FIFO
+      @param n the number of bits to push (0 to 32)
+      @return true if all the bits were stored correctly, false otherwise (not
+     enough space in the FIFO, no bit is stored in such a case)
+  */
+  bool pushBits(uint32_t value, uint8_t n) {
+    uint8_t t = tail;
+    if ((n > 32) || (n > N - (uint8_t)(t - head))) {
+      return false; // not enough space in the FIFO
+    }
+    while (n > 0) {
+      n--;
+      writeBit(t++, (value >> n) & 1);
+    }
+    tail = t;
+    return true;
+  };
+
+  /*!
+      @brief  removes the value at the head of the FIFO and returns it to the
+     caller (consumer)
+      @return the oldest element still stored, false if the FIFO is empty
+  */
+  bool pull() {
+    uint8_t h = head;
+    if (h == tail) {
+      return false; // FIFO is empty
+    }
+    bool value = readBit(h);
+    head = h + 1;
+    return value;
+  };
+
+  /*!
+      @brief  removes up to 32 bits from the head of the FIFO and returns them
+     to the caller (consumer)
+      @details same as boolFifo::pullBits()
+      @param n the number of bits to pull (0 to 32)
+      @return the oldest n bits still stored, or 0 if less than n bits are
+     stored (no bit is removed in such a case)
+  */
+  uint32_t pullBits(uint8_t n) {
+    uint8_t h = head;
+    if ((n > 32) || (n > (uint8_t)(tail - h))) {
+      return 0; // not enough data in the FIFO
+    }
+    uint32_t value = 0;
+    while (n > 0) {
+      value = (value << 1) | readBit(h++);
+      n--;
+    }
+    head = h;
+    return value;
+  };
+
+  /*!
+      @brief  remove all the data stored in the FIFO (consumer)
+  */
+  void flush() { head = tail; };
+
+  /*!
+      @brief  check if the buffer is empty
+      @return true if empty, false otherwise
+  */
+  bool empty() const { return head == tail; };
+
+  /*!
+      @brief  check if the buffer is full
+      @return true if full, false otherwise
+  */
+  bool full() const { return size() == N; }
+
+  /*!
+      @brief  get the number of records stored in the FIFO
+      @details when called by the producer, the FIFO may contain less records
+     (if the consumer pulls data in the meantime). When called by the consumer,
+     the FIFO may contain more records (if the producer pushes data in the
+     meantime).
+      @return the number of records currently in the FIFO queue
+  */
+  uint8_t size() const { return (uint8_t)(tail - head); };
+
+private:
+  /*!
+      @brief  write one bit in the buffer
+      @param index the (free running) index of the bit
+      @param value the value of the bit
+  */
+  inline void writeBit(uint8_t index, bool value) {
+    index &= (N - 1);
+    uint8_t mask = 0x80 >> (index & 0x07);
+    if (value) {
+      buffer[index >> 3] |= mask;
+    } else {
+      buffer[index >> 3] &= ~mask;
+    }
+  };
+  /*!
+      @brief  read one bit from the buffer
+      @param index the (free running) index of the bit
+      @return the value of the bit
+  */
+  inline bool readBit(uint8_t index) const {
+    index &= (N - 1);
+    return (buffer[index >> 3] & (0x80 >> (index & 0x07))) != 0;
+  };
+
+  volatile uint8_t buffer[N / 8]; ///< the FIFO buffer, 8 bits per byte
+  volatile uint8_t head;          ///< index to the head, updated by the consumer
+  volatile uint8_t tail;          ///< index to the tail, updated by the producer
+};
+
+#endif // K197CTRL_SPSC_BOOL_FIFO_H